@@ -0,0 +1,148 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EDGE_RING_H_
+#define _EDGE_RING_H_
+#include <stdint.h>
+
+/*
+ Plain C++ only (no Arduino/AVR headers) so the capture and packing logic can be
+ compiled and exercised on a host as well.
+*/
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+#define RING_BARRIER()          __asm__ __volatile__("" ::: "memory")
+
+// raw pin change as seen by a PCINT ISR
+typedef struct _edge_record {
+    uint8_t     port;           // index of the port in D-B-C order
+    uint8_t     chg;            // changed bits, port register layout
+    uint8_t     value;          // masked port value after the change
+    uint16_t    tick;           // millis() & 0xffff
+} edge_record_t;
+
+/*
+*****************************************************************************************
+* FUNCTIONS
+*****************************************************************************************
+*/
+// contiguous masked field of a port register, moved down to bit 0
+static inline uint8_t port_field(uint8_t value, uint8_t mask, uint8_t nz_bit) {
+    return (value & mask) >> nz_bit;
+}
+
+static inline uint8_t bit_count(uint8_t value) {
+    //  parallel adding in a register SWAG algorithm
+    uint8_t v = value;
+    v = v - ((v >> 1) & 0x55);
+    v = (v & 0x33) + ((v >> 2) & 0x33);
+    v = (v + (v >> 4)) & 0x0F;
+    return v;
+}
+
+// pack the per port fields into one word, first port in the lowest bits
+static inline uint16_t port_pack(const uint8_t *fields, const uint8_t *lens, uint8_t cnt) {
+    uint16_t d16 = 0;
+    uint8_t  shl = 0;
+
+    for (uint8_t i = 0; i < cnt; i++) {
+        d16 |= ((uint16_t)fields[i] << shl);
+        shl += lens[i];
+    }
+    return d16;
+}
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// single producer (pin change ISR) / single consumer (I2C request) ring.
+// head is only written by the producer and tail by the consumer, both are single bytes
+// so neither side has to disable interrupts.
+template <uint8_t N>
+class EdgeRing {
+public:
+    EdgeRing() {
+        _head     = 0;
+        _tail     = 0;
+        _overflow = 0;
+    }
+
+    bool push(uint8_t port, uint8_t chg, uint8_t value, uint16_t tick) {
+        uint8_t head = _head;
+
+        if ((uint8_t)(head - _tail) >= N) {
+            if (_overflow < 0xffff)
+                _overflow++;
+            return false;
+        }
+
+        edge_record_t *rec = &_recs[head & (N - 1)];
+        rec->port  = port;
+        rec->chg   = chg;
+        rec->value = value;
+        rec->tick  = tick;
+        RING_BARRIER();
+        _head = head + 1;
+        return true;
+    }
+
+    edge_record_t *peek() {
+        uint8_t tail = _tail;
+
+        if (tail == _head)
+            return 0;
+        RING_BARRIER();
+        return &_recs[tail & (N - 1)];
+    }
+
+    void drop() {
+        if (_tail != _head)
+            _tail = _tail + 1;
+    }
+
+    void clear() {
+        _tail = _head;
+    }
+
+    uint8_t count() {
+        return (uint8_t)(_head - _tail);
+    }
+
+    edge_record_t *at(uint8_t i) {
+        return &_recs[(uint8_t)(_tail + i) & (N - 1)];
+    }
+
+    uint16_t overflow() {
+        return _overflow;
+    }
+
+    void clear_overflow() {
+        _overflow = 0;
+    }
+
+private:
+    static_assert((N & (N - 1)) == 0 && N <= 128, "N must be a power of 2 up to 128");
+
+    edge_record_t     _recs[N];
+    volatile uint8_t  _head;
+    volatile uint8_t  _tail;
+    volatile uint16_t _overflow;    // records dropped because the ring was full
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _KEY_MATRIX_H_
+#define _KEY_MATRIX_H_
+#include <Arduino.h>
+#include "EdgeRing.h"
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// row/column key matrix without diodes.
+// idle  : every row driven low, columns pulled up with pin change interrupts, so any key
+//         wakes the MCU from power down.
+// scan  : one row low at a time (the others floating), pressed keys read as low columns.
+class KeyMatrix {
+public:
+    enum : int { kMAX_ROWS = 8 };
+
+    typedef void (*report_fn)(uint8_t row, uint8_t chg, uint8_t value);
+
+    KeyMatrix(const uint8_t *rows, uint8_t row_cnt, const uint8_t *cols, uint8_t col_cnt) {
+        _rows    = rows;
+        _row_cnt = min(row_cnt, (uint8_t)kMAX_ROWS);
+        _cols    = cols;
+        _col_cnt = min(col_cnt, (uint8_t)8);
+        _ghosts  = 0;
+        _ghost_rows = 0;
+        _pcifr   = 0;
+        memset(_state, 0, sizeof(_state));
+        memset(_integ, 0, sizeof(_integ));
+    }
+
+    void setup() {
+        for (uint8_t c = 0; c < _col_cnt; c++) {
+            pinMode(_cols[c], INPUT_PULLUP);
+            *digitalPinToPCMSK(_cols[c]) |= _BV(digitalPinToPCMSKbit(_cols[c]));
+            _pcifr |= _BV(digitalPinToPCICRbit(_cols[c]));
+        }
+        PCICR |= _pcifr;
+        idle();
+    }
+
+    void idle() {
+        for (uint8_t r = 0; r < _row_cnt; r++) {
+            digitalWrite(_rows[r], LOW);
+            pinMode(_rows[r], OUTPUT);
+        }
+    }
+
+    // one full scan with integrator debounce in scan units, returns true while any key
+    // is pressed or settling so the caller keeps the scan timer running
+    bool scan(uint8_t max_cnt, report_fn report) {
+        uint8_t raw[kMAX_ROWS];
+        bool    busy = false;
+
+        for (uint8_t r = 0; r < _row_cnt; r++)
+            pinMode(_rows[r], INPUT);
+
+        for (uint8_t r = 0; r < _row_cnt; r++) {
+            digitalWrite(_rows[r], LOW);
+            pinMode(_rows[r], OUTPUT);
+            delayMicroseconds(5);
+
+            raw[r] = 0;
+            for (uint8_t c = 0; c < _col_cnt; c++) {
+                if (digitalRead(_cols[c]) == LOW)
+                    raw[r] |= _BV(c);
+            }
+            pinMode(_rows[r], INPUT);
+        }
+        idle();
+        // driving the rows toggles the columns of held keys, those are not new presses
+        PCIFR = _pcifr;
+
+        // without diodes, three keys on the corners of a rectangle make the fourth corner
+        // read as pressed. Two rows sharing two or more columns can not be trusted, keep
+        // their last stable state until the rectangle is broken
+        uint8_t ghost = 0;
+        for (uint8_t i = 0; i < _row_cnt; i++) {
+            for (uint8_t j = i + 1; j < _row_cnt; j++) {
+                if (bit_count(raw[i] & raw[j]) >= 2)
+                    ghost |= _BV(i) | _BV(j);
+            }
+        }
+        if (ghost && !_ghost_rows && _ghosts < 0xff)
+            _ghosts++;
+        _ghost_rows = ghost;
+
+        for (uint8_t r = 0; r < _row_cnt; r++) {
+            uint8_t value = _state[r];
+
+            if (ghost & _BV(r)) {
+                busy = true;
+                continue;
+            }
+
+            for (uint8_t c = 0; c < _col_cnt; c++) {
+                uint8_t *cnt = &_integ[r][c];
+
+                if (raw[r] & _BV(c))
+                    *cnt = (*cnt < max_cnt) ? *cnt + 1 : max_cnt;
+                else if (*cnt > 0)
+                    (*cnt)--;
+
+                if (*cnt >= max_cnt)
+                    value |= _BV(c);
+                else if (*cnt == 0)
+                    value &= ~_BV(c);
+                if (*cnt != 0)
+                    busy = true;
+            }
+
+            if (value != _state[r]) {
+                report(r, value ^ _state[r], value);
+                _state[r] = value;
+            }
+        }
+        return busy;
+    }
+
+    uint8_t get_row(uint8_t row)    { return _state[row]; }
+    uint8_t get_row_count()         { return _row_cnt; }
+    uint8_t get_col_count()         { return _col_cnt; }
+    uint8_t get_key_count()         { return _row_cnt * _col_cnt; }
+    uint8_t get_ghost_count()       { return _ghosts; }
+
+private:
+    const uint8_t *_rows;
+    const uint8_t *_cols;
+    uint8_t        _row_cnt;
+    uint8_t        _col_cnt;
+    uint8_t        _state[kMAX_ROWS];           // debounced, bit set = pressed
+    uint8_t        _integ[kMAX_ROWS][8];
+    uint8_t        _ghost_rows;
+    uint8_t        _ghosts;                     // ghosting episodes seen, saturates
+    uint8_t        _pcifr;                      // pin change groups of the columns
+};
+
+#endif
@@ -7,24 +7,55 @@
 *****************************************************************************************
 */
 #define __DEBUG__           1
+#define __ADDR_STRAP__      0           // add A6/A7 straps (GND/VCC) to the slave address
 
 /*
 *****************************************************************************************
 * CONSTANTS
 *****************************************************************************************
 */
-#define I2C_SLAVE_ADDR          0x21
+#define I2C_SLAVE_ADDR          0x21            // default, overridden by EEPROM_I2C_ADDR
+#define EEPROM_I2C_ADDR         0
+#define EEPROM_SCAN_MODE        1
+enum {
+    SCAN_MODE_DIRECT = 0,           // one key per pin, 14 keys
+    SCAN_MODE_MATRIX,               // row/column matrix, MATRIX_ROWS * MATRIX_COLS keys
+};
+
 enum {
     I2C_REG_NOP = 0x00,
-    I2C_REG_SET_POWER_DOWN,
-    I2C_REG_GET_PIN_STATUS,
+    I2C_REG_SET_POWER_DOWN,         // W : drop pending events, latch the next key and sleep until it
+    I2C_REG_GET_PIN_STATUS,         // R : uint16 pin snapshot, discards pending events
+    I2C_REG_GET_EVENT_COUNT,        // R : uint8 number of pending events
+    I2C_REG_GET_EVENTS,             // W : [max events], R : uint8 count + count * pin_event_t
+    I2C_REG_GET_OVERFLOW,           // R : uint16 pin changes dropped since the last read
+    I2C_REG_SET_DEBOUNCE,           // W : [ms] stable time before a change is reported, 1-255
+    I2C_REG_GET_DEBOUNCE,           // R : uint8 debounce ms
+    I2C_REG_SET_ADDR,               // W : [addr] 0x08-0x77 stored in EEPROM, used after reset
+    I2C_REG_SET_SCAN_MODE,          // W : [SCAN_MODE_xxx] stored in EEPROM, used after reset
+    I2C_REG_SET_SCAN_RATE,          // W : [ms] matrix scan period, 1-255
+    I2C_REG_GET_SCAN_RATE,          // R : uint8 scan period ms
+    I2C_REG_GET_KEY_COUNT,          // R : uint8 number of keys in the current mode
+    I2C_REG_GET_MATRIX_STATUS,      // R : one byte per row, bit set = pressed
+    I2C_REG_GET_GHOST_COUNT,        // R : uint8 ghosting episodes, saturates at 255
+    I2C_REG_GET_WAKE_KEY,           // R : pin_event_t that ended the power down, code WAKE_KEY_NONE if none
 };
 
+#define DEBOUNCE_MS_DEFAULT     10
+#define SCAN_MS_DEFAULT         5               // matrix debounce is counted in scans
+
+#define EDGE_RING_SIZE          32              // raw pin change records, power of 2
+#define EVENT_BURST_MAX         10              // (Wire buffer 32 - count byte) / sizeof(pin_event_t)
+
 // total 14pins, pin number order : D-B-C
 #define PORTB_PC_MASK           B00011111       // PortB (D8 - D13), D13 used for interrupt
 #define PORTC_PC_MASK           B00001111       // PortC (A0-A5), A4/A5 used for I2C
 #define PORTD_PC_MASK           B11111100       // PortD (D0-D7), D0/D1 used for UART
 
+// 7 x 7 = 49 keys on the same 14 pins, no diodes
+#define MATRIX_ROWS             7
+#define MATRIX_COLS             7
+
 
 /*
 *****************************************************************************************
@@ -32,7 +63,11 @@ enum {
 *****************************************************************************************
 */
 // #define PIN_LED                 13
-#define PIN_INT_REQ             13
+#define PIN_INT_REQ             13              // open drain, shared by all expanders, low = request
+#define PINS_MATRIX_ROW         2, 3, 4, 5, 6, 7, 8
+#define PINS_MATRIX_COL         9, 10, 11, 12, A0, A1, A2
+#define PIN_ADDR_STRAP0         A6
+#define PIN_ADDR_STRAP1         A7
 #define PIN_HW_SDA              A4
 #define PIN_HW_SCL              A5
 
@@ -42,6 +77,14 @@ enum {
 * MACROS & STRUCTURES
 *****************************************************************************************
 */
+#define EVENT_PIN_MASK          0x3F            // pin number in D-B-C order or row * MATRIX_COLS + col
+#define EVENT_EDGE_HIGH         0x80            // pin went high (matrix : key pressed), otherwise low
+#define WAKE_KEY_NONE           0xFF
+
+typedef struct __attribute__((packed)) _pin_event {
+    uint8_t     code;                           // pin | EVENT_EDGE_HIGH
+    uint16_t    ts;                             // millis() & 0xffff
+} pin_event_t;
 
 
 
@@ -1,15 +1,48 @@
 #include <Arduino.h>
 #include <Wire.h>
+#include <EEPROM.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include "utils.h"
-#include "LowPower.h"
+#include "EdgeRing.h"
+#include "KeyMatrix.h"
 
 /*
 *****************************************************************************************
 * Class
 *****************************************************************************************
 */
+static EdgeRing<EDGE_RING_SIZE> _edges;
+
+// several expanders share the request line, so it is only ever pulled low or released
+static inline void int_assert() {
+    digitalWrite(PIN_INT_REQ, LOW);
+    pinMode(PIN_INT_REQ, OUTPUT);
+}
+
+static inline void int_release() {
+    pinMode(PIN_INT_REQ, INPUT);
+}
+
+// armed by I2C_REG_SET_POWER_DOWN, the first record after that is kept for I2C_REG_GET_WAKE_KEY
+static volatile bool  _wake_armed = false;
+static edge_record_t  _wake_rec;
+
+// called from the debounce tick only
+static void push_edge(uint8_t port, uint8_t chg, uint8_t value) {
+    uint16_t tick = millis();
+
+    if (_wake_armed) {
+        _wake_rec.port  = port;
+        _wake_rec.chg   = chg;
+        _wake_rec.value = value;
+        _wake_rec.tick  = tick;
+        _wake_armed     = false;
+    }
+    _edges.push(port, chg, value, tick);
+    int_assert();
+}
+
 class PortCfg {
 public:
     PortCfg(uint8_t idx, uint8_t mask) {
@@ -40,22 +73,51 @@ public:
         find_nz_bit_counts(_pc_mask, &_nz_bit, &_nz_len);
     }
 
-    void interrupt() {
-        uint8_t old_sreg = SREG;
+    // integrator debounce, called every 1ms tick while any pin is settling.
+    // a pin flips only after its counter walked all the way to 0 or max_cnt,
+    // returns true while some counter is still in between
+    bool sample(uint8_t max_cnt) {
+        uint8_t raw   = *_pin_reg & _pc_mask;
+        uint8_t value = _value;
+        uint8_t chg;
+        bool    busy  = false;
+
+        for (uint8_t bit = _nz_bit; bit < _nz_bit + _nz_len; bit++) {
+            uint8_t cnt = _integ[bit];
+
+            if (raw & _BV(bit))
+                cnt = (cnt < max_cnt) ? cnt + 1 : max_cnt;
+            else if (cnt > 0)
+                cnt--;
+
+            if (cnt == max_cnt)
+                value |= _BV(bit);
+            else if (cnt == 0)
+                value &= ~_BV(bit);
+            else
+                busy = true;
+            _integ[bit] = cnt;
+        }
 
-        cli();
-        _value = *_pin_reg & _pc_mask;
-        if (digitalRead(PIN_INT_REQ) == LOW)
-            digitalWrite(PIN_INT_REQ, HIGH);
-        SREG = old_sreg;
+        // every stable change is queued, even ones the master has not read the previous state of
+        chg = value ^ _value;
+        if (chg) {
+            _value = value;
+            push_edge(_order, chg, value);
+        }
+        return busy;
     }
 
-    void setup() {
+    void setup(uint8_t order, uint8_t shl, uint8_t max_cnt) {
         // port configuration : inputs for PC pins
         *_dir_reg    &= ~_pc_mask;
         *_port_reg   |= _pc_mask;
         *_pcmask_reg |= _pc_mask;
-        _value        = *_pin_reg;
+        _value        = *_pin_reg & _pc_mask;
+        _order        = order;
+        _shl          = shl;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            _integ[bit] = (_value & _BV(bit)) ? max_cnt : 0;
         LOG("PCMASK:%d %2X=> %d, %d V:%2x\n", _idx, _pc_mask, _nz_bit, _nz_len, get());
 
         // enable port change interrupt
@@ -63,7 +125,12 @@ public:
     }
 
     uint8_t get() {
-        return (_value >> _nz_bit) & (_pc_mask >> _nz_bit);
+        return port_field(_value, _pc_mask, _nz_bit);
+    }
+
+    // pin number in get_port_status() bit order
+    uint8_t to_pin(uint8_t bit) {
+        return _shl + bit - _nz_bit;
     }
 
     uint8_t get_bits_len() {
@@ -99,7 +166,10 @@ private:
         *count = cnt;
     }
 
+    uint8_t _integ[8];
     uint8_t _idx;
+    uint8_t _order;
+    uint8_t _shl;
     uint8_t _value;
     uint8_t _pc_mask;
     int8_t  _nz_bit;
@@ -117,6 +187,17 @@ private:
 *****************************************************************************************
 */
 static uint8_t _i2c_cmd;
+static uint8_t _i2c_param;
+
+static volatile uint8_t _debounce_ms = DEBOUNCE_MS_DEFAULT;
+static volatile uint8_t _scan_ms     = SCAN_MS_DEFAULT;
+static volatile bool    _debouncing  = false;
+static uint8_t          _scan_mode   = SCAN_MODE_DIRECT;
+static uint8_t          _scan_tick;
+
+// edge record being expanded into pin events and its changed bits not yet reported
+static edge_record_t _edge_cur;
+static uint8_t       _edge_left;
 
 // pin number order : D-B-C (D0-D7, D8-D13, A0-A5)
 static PortCfg _port_cfg[3] = {
@@ -125,6 +206,13 @@ static PortCfg _port_cfg[3] = {
     PortCfg(1, PORTC_PC_MASK)
 };
 
+// matrix rows are kept apart from the D-B-C port records by EDGE_PORT_MATRIX
+#define EDGE_PORT_MATRIX    0x80
+
+static const uint8_t _matrix_rows[MATRIX_ROWS] = { PINS_MATRIX_ROW };
+static const uint8_t _matrix_cols[MATRIX_COLS] = { PINS_MATRIX_COL };
+static KeyMatrix     _matrix(_matrix_rows, MATRIX_ROWS, _matrix_cols, MATRIX_COLS);
+
 
 /*
 *****************************************************************************************
@@ -136,46 +224,194 @@ void i2c_receiveEvent(int len) {
     uint8_t param;
 
     cmd = Wire.read();
-    if (len > 1)
-        param = Wire.read();
+    param = (len > 1) ? Wire.read() : 0;
 
     //LOG(F("cmd : %10ld, %x len:%d\n"), millis(), cmd, len);
     switch (cmd) {
         case I2C_REG_SET_POWER_DOWN:
-            LowPower.powerDown(SLEEP_FOREVER, ADC_OFF, BOD_OFF);
+            // the master is going to sleep on the request line, so it has to be released now.
+            // sleeping is left to loop(), a receive ISR that never returns would hold the bus
+            _edges.clear();
+            _edge_left     = 0;
+            _wake_rec.chg  = 0;
+            _wake_armed    = true;
+            int_release();
+            break;
+
+        case I2C_REG_SET_DEBOUNCE:
+            if (param > 0)
+                _debounce_ms = param;
+            break;
+
+        case I2C_REG_SET_ADDR:
+            if (param >= 0x08 && param <= 0x77)
+                EEPROM.update(EEPROM_I2C_ADDR, param);
+            break;
+
+        case I2C_REG_SET_SCAN_MODE:
+            if (param <= SCAN_MODE_MATRIX)
+                EEPROM.update(EEPROM_SCAN_MODE, param);
+            break;
+
+        case I2C_REG_SET_SCAN_RATE:
+            if (param > 0)
+                _scan_ms = param;
             break;
 
         default:
-            _i2c_cmd = cmd;
+            _i2c_cmd   = cmd;
+            _i2c_param = param;
             break;
     }
 }
 
 uint16_t get_port_status() {
-    uint16_t    d16 = 0;
-    uint8_t     shl = 0;
+    uint8_t     fields[ARRAY_SIZE(_port_cfg)];
+    uint8_t     lens[ARRAY_SIZE(_port_cfg)];
     uint8_t     old_sreg = SREG;
 
+    // matrix : the first 16 keys, the whole matrix is read with I2C_REG_GET_MATRIX_STATUS
+    if (_scan_mode == SCAN_MODE_MATRIX) {
+        uint16_t d16 = 0;
+
+        for (uint8_t key = 0; key < 16 && key < _matrix.get_key_count(); key++) {
+            if (_matrix.get_row(key / MATRIX_COLS) & _BV(key % MATRIX_COLS))
+                d16 |= _BV(key);
+        }
+        return d16;
+    }
+
     cli();
     for (uint8_t i = 0; i < ARRAY_SIZE(_port_cfg); i++) {
-        d16 |= ((uint16_t)_port_cfg[i].get() << shl);
-        shl += _port_cfg[i].get_bits_len();
+        fields[i] = _port_cfg[i].get();
+        lens[i]   = _port_cfg[i].get_bits_len();
     }
     SREG = old_sreg;
 
-    return d16;
+    return port_pack(fields, lens, ARRAY_SIZE(_port_cfg));
+}
+
+static uint8_t to_code(edge_record_t *rec, uint8_t bit) {
+    uint8_t code;
+
+    if (rec->port & EDGE_PORT_MATRIX)
+        code = (rec->port & ~EDGE_PORT_MATRIX) * MATRIX_COLS + bit;
+    else
+        code = _port_cfg[rec->port].to_pin(bit);
+    return code | ((rec->value & _BV(bit)) ? EVENT_EDGE_HIGH : 0);
+}
+
+static uint8_t lowest_bit(uint8_t value) {
+    uint8_t bit;
+
+    for (bit = 0; !(value & _BV(bit)); bit++)
+        ;
+    return bit;
+}
+
+static bool next_event(pin_event_t *evt) {
+    uint8_t bit;
+
+    while (_edge_left == 0) {
+        edge_record_t *rec = _edges.peek();
+
+        if (rec == NULL)
+            return false;
+        _edge_cur  = *rec;
+        _edge_left = rec->chg;
+        _edges.drop();
+    }
+
+    bit = lowest_bit(_edge_left);
+    _edge_left &= ~_BV(bit);
+    evt->code = to_code(&_edge_cur, bit);
+    evt->ts   = _edge_cur.tick;
+
+    return true;
+}
+
+static uint8_t get_event_count() {
+    uint8_t cnt = bit_count(_edge_left);
+
+    for (uint8_t i = 0; i < _edges.count(); i++)
+        cnt += bit_count(_edges.at(i)->chg);
+    return cnt;
 }
 
 void i2c_requestEvent() {
     uint16_t    d16;
+    uint8_t     cnt;
     uint8_t     cmd = _i2c_cmd;
+    pin_event_t evt;
 
     _i2c_cmd = I2C_REG_NOP;
     switch (cmd) {
         case I2C_REG_GET_PIN_STATUS:
+            _edges.clear();
+            _edge_left = 0;
             d16 = get_port_status();
             Wire.write((uint8_t*)&d16, 2);
-            digitalWrite(PIN_INT_REQ, LOW);
+            int_release();
+            break;
+
+        case I2C_REG_GET_EVENT_COUNT:
+            cnt = get_event_count();
+            Wire.write(cnt);
+            break;
+
+        case I2C_REG_GET_EVENTS:
+            // burst : count byte then the events, all in one transaction
+            cnt = (_i2c_param > 0) ? _i2c_param : EVENT_BURST_MAX;
+            cnt = min(cnt, min(get_event_count(), EVENT_BURST_MAX));
+            Wire.write(cnt);
+            for (uint8_t i = 0; i < cnt && next_event(&evt); i++)
+                Wire.write((uint8_t*)&evt, sizeof(evt));
+            if (get_event_count() == 0)
+                int_release();
+            break;
+
+        case I2C_REG_GET_OVERFLOW:
+            d16 = _edges.overflow();
+            _edges.clear_overflow();
+            Wire.write((uint8_t*)&d16, 2);
+            break;
+
+        case I2C_REG_GET_DEBOUNCE:
+            Wire.write(_debounce_ms);
+            break;
+
+        case I2C_REG_GET_SCAN_RATE:
+            Wire.write(_scan_ms);
+            break;
+
+        case I2C_REG_GET_KEY_COUNT:
+            cnt = 0;
+            if (_scan_mode == SCAN_MODE_MATRIX) {
+                cnt = _matrix.get_key_count();
+            } else {
+                for (uint8_t i = 0; i < ARRAY_SIZE(_port_cfg); i++)
+                    cnt += _port_cfg[i].get_bits_len();
+            }
+            Wire.write(cnt);
+            break;
+
+        case I2C_REG_GET_MATRIX_STATUS:
+            for (uint8_t r = 0; r < MATRIX_ROWS; r++)
+                Wire.write((_scan_mode == SCAN_MODE_MATRIX) ? _matrix.get_row(r) : 0);
+            break;
+
+        case I2C_REG_GET_GHOST_COUNT:
+            Wire.write(_matrix.get_ghost_count());
+            break;
+
+        case I2C_REG_GET_WAKE_KEY:
+            // several keys settling in the same tick share a record, the lowest one wins
+            evt.code = WAKE_KEY_NONE;
+            evt.ts   = _wake_rec.tick;
+            if (!_wake_armed && _wake_rec.chg)
+                evt.code = to_code(&_wake_rec, lowest_bit(_wake_rec.chg));
+            _wake_rec.chg = 0;
+            Wire.write((uint8_t*)&evt, sizeof(evt));
             break;
     }
 }
@@ -186,19 +422,61 @@ void i2c_requestEvent() {
 *****************************************************************************************
 */
 
+// Timer2 1ms tick, only runs while some pin is settling or a matrix key is held
+static void start_debounce() {
+    if (_debouncing)
+        return;
+
+    _debouncing = true;
+    _scan_tick  = 0;
+    TCNT2  = 0;
+    OCR2A  = (F_CPU / 64 / 1000) - 1;
+    TCCR2A = _BV(WGM21);                // CTC
+    TCCR2B = _BV(CS22);                 // clk/64
+    TIMSK2 = _BV(OCIE2A);
+}
+
+static void stop_debounce() {
+    TIMSK2 = 0;
+    TCCR2B = 0;
+    _debouncing = false;
+}
+
+static void matrix_report(uint8_t row, uint8_t chg, uint8_t value) {
+    push_edge(EDGE_PORT_MATRIX | row, chg, value);
+}
+
+ISR(TIMER2_COMPA_vect) {
+    bool busy = false;
+
+    if (_scan_mode == SCAN_MODE_MATRIX) {
+        // one scan every _scan_ms ticks, the debounce time is counted in scans
+        busy = (_scan_tick == 0) ? _matrix.scan(max(_debounce_ms / _scan_ms, 1), matrix_report) : true;
+        if (++_scan_tick >= _scan_ms)
+            _scan_tick = 0;
+    } else {
+        for (uint8_t i = 0; i < ARRAY_SIZE(_port_cfg); i++)
+            busy |= _port_cfg[i].sample(_debounce_ms);
+    }
+    if (!busy)
+        stop_debounce();
+}
+
+// pin changes only kick the debounce timer, the tick decides what is reported.
+// in matrix mode only the columns interrupt, a key press pulls one low against the idle rows
 // PortB (D8-D13)
 ISR(PCINT0_vect) {
-    _port_cfg[1].interrupt();
+    start_debounce();
 }
 
 // PortC (A0-A5)
 ISR(PCINT1_vect) {
-    _port_cfg[2].interrupt();
+    start_debounce();
 }
 
 // PortD (D0-D7)
 ISR(PCINT2_vect) {
-    _port_cfg[0].interrupt();
+    start_debounce();
 }
 
 #if defined(ARDUINO_ARCH_AVR)
@@ -208,24 +486,52 @@ static int serialPutc(char c, FILE *) {
 }
 #endif
 
+static uint8_t get_slave_addr() {
+    uint8_t addr = EEPROM.read(EEPROM_I2C_ADDR);
+
+    if (addr < 0x08 || addr > 0x77)
+        addr = I2C_SLAVE_ADDR;
+
+#if __ADDR_STRAP__
+    // A6/A7 are analog only inputs, they have to be tied to GND or VCC
+    if (analogRead(PIN_ADDR_STRAP0) > 512)
+        addr += 1;
+    if (analogRead(PIN_ADDR_STRAP1) > 512)
+        addr += 2;
+#endif
+    return addr;
+}
+
 void setup() {
 #if defined(ARDUINO_ARCH_AVR)
     fdevopen(&serialPutc, 0);
 #endif
 
     Serial.begin(115200);
-    pinMode(PIN_INT_REQ, OUTPUT);
-    digitalWrite(PIN_INT_REQ, LOW);
+    int_release();
 
     // i2c slave
-    Wire.begin(I2C_SLAVE_ADDR);
+    uint8_t addr = get_slave_addr();
+    LOG("I2C addr:%02x\n", addr);
+    Wire.begin(addr);
     Wire.onReceive(i2c_receiveEvent);
     Wire.onRequest(i2c_requestEvent);
 
-    for (uint8_t i = 0; i < ARRAY_SIZE(_port_cfg); i++) {
-        _port_cfg[i].setup();
+    _scan_mode = EEPROM.read(EEPROM_SCAN_MODE);
+    if (_scan_mode == SCAN_MODE_MATRIX) {
+        _matrix.setup();
+        // one scan picks up keys that are already held
+        start_debounce();
+    } else {
+        uint8_t shl = 0;
+
+        _scan_mode = SCAN_MODE_DIRECT;
+        for (uint8_t i = 0; i < ARRAY_SIZE(_port_cfg); i++) {
+            _port_cfg[i].setup(i, shl, _debounce_ms);
+            shl += _port_cfg[i].get_bits_len();
+        }
     }
-    LOG("Start !!\n");
+    LOG("Start mode:%d !!\n", _scan_mode);
     delay(100);
 }
 
@@ -250,18 +556,36 @@ static void bits2Str(char *buf, void const * const ptr, size_t const size) {
     *buf = 0;
 }
 
+static void sleep_until_event() {
+    // the mode is picked with interrupts off and sei() always runs the next instruction,
+    // so a pin change that starts the debounce timer here still wakes the sleep below
+    cli();
+    if (_debouncing) {
+        // Timer2 runs on the I/O clock, only idle keeps it ticking
+        set_sleep_mode(SLEEP_MODE_IDLE);
+    } else {
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        ADCSRA &= ~_BV(ADEN);
+    }
+    sleep_enable();
+    // every power down runs with the BOD off as LowPower.powerDown(.., BOD_OFF) did, it has
+    // to be right before sleep_cpu()
+    if (!_debouncing)
+        sleep_bod_disable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
 void loop() {
-    LowPower.powerDown(SLEEP_FOREVER, ADC_OFF, BOD_OFF);
+    sleep_until_event();
 
-    // if (d16 != _d16) {
-    if (true) {
+    uint16_t d16 = get_port_status();
+    if (d16 != _d16) {
         char     buf[20];
-        uint16_t d16 = get_port_status();
 
         bits2Str(buf, &d16, sizeof(d16));
         LOG("%8ld PIN:%4X %s\n", millis(), d16, buf);
         _d16 = d16;
-        delay(100);
-        digitalWrite(PIN_INT_REQ, LOW);
     }
 }
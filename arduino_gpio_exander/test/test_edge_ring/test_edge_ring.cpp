@@ -0,0 +1,131 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <unity.h>
+#include "EdgeRing.h"
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// the byte indexes run over 255 many times, every record comes out in order
+void test_ring_wrap(void) {
+    EdgeRing<8> ring;
+    uint16_t    next = 0;
+
+    for (uint16_t i = 0; i < 1000; i++) {
+        TEST_ASSERT_TRUE(ring.push(i & 3, i & 0xff, ~i & 0xff, i));
+        if (ring.count() < 5)
+            continue;
+        while (ring.count() > 0) {
+            edge_record_t *rec = ring.peek();
+
+            TEST_ASSERT_NOT_NULL(rec);
+            TEST_ASSERT_EQUAL_UINT8(next & 3, rec->port);
+            TEST_ASSERT_EQUAL_UINT8(next & 0xff, rec->chg);
+            TEST_ASSERT_EQUAL_UINT8(~next & 0xff, rec->value);
+            TEST_ASSERT_EQUAL_UINT16(next, rec->tick);
+            ring.drop();
+            next++;
+        }
+    }
+    TEST_ASSERT_NULL(ring.peek());
+    TEST_ASSERT_EQUAL_UINT16(0, ring.overflow());
+}
+
+// a full ring keeps the oldest records and counts what it refused
+void test_ring_overflow(void) {
+    EdgeRing<4> ring;
+
+    for (uint8_t i = 0; i < 4; i++)
+        TEST_ASSERT_TRUE(ring.push(0, i, 0, i));
+    TEST_ASSERT_FALSE(ring.push(0, 4, 0, 4));
+    TEST_ASSERT_FALSE(ring.push(0, 5, 0, 5));
+    TEST_ASSERT_EQUAL_UINT8(4, ring.count());
+    TEST_ASSERT_EQUAL_UINT16(2, ring.overflow());
+
+    for (uint8_t i = 0; i < 4; i++)
+        TEST_ASSERT_EQUAL_UINT8(i, ring.at(i)->chg);
+
+    // room again after one is read
+    ring.drop();
+    TEST_ASSERT_TRUE(ring.push(0, 6, 0, 6));
+    TEST_ASSERT_EQUAL_UINT8(6, ring.at(3)->chg);
+
+    ring.clear_overflow();
+    TEST_ASSERT_EQUAL_UINT16(0, ring.overflow());
+    ring.clear();
+    TEST_ASSERT_EQUAL_UINT8(0, ring.count());
+    TEST_ASSERT_NULL(ring.peek());
+    ring.drop();
+    TEST_ASSERT_EQUAL_UINT8(0, ring.count());
+}
+
+// the counter stops at its top instead of wrapping to 0
+void test_ring_overflow_saturates(void) {
+    EdgeRing<1> ring;
+
+    TEST_ASSERT_TRUE(ring.push(0, 0, 0, 0));
+    for (uint32_t i = 0; i < 0x10010; i++)
+        ring.push(0, 0, 0, 0);
+    TEST_ASSERT_EQUAL_UINT16(0xffff, ring.overflow());
+}
+
+void test_bit_count(void) {
+    for (uint16_t v = 0; v < 256; v++) {
+        uint8_t cnt = 0;
+
+        for (uint8_t b = 0; b < 8; b++)
+            cnt += (v >> b) & 1;
+        TEST_ASSERT_EQUAL_UINT8(cnt, bit_count(v));
+    }
+}
+
+void test_port_field(void) {
+    TEST_ASSERT_EQUAL_UINT8(0x05, port_field(0xd4, 0x1c, 2));
+    TEST_ASSERT_EQUAL_UINT8(0x3f, port_field(0xff, 0x3f, 0));
+    TEST_ASSERT_EQUAL_UINT8(0x00, port_field(0x3f, 0xc0, 6));
+}
+
+// D2-D7, B0-B4 and C0-C3 of the expander give 15 keys in one word
+void test_port_pack(void) {
+    const uint8_t lens[]  = { 6, 5, 4 };
+    const uint8_t all[]   = { 0x3f, 0x1f, 0x0f };
+    const uint8_t first[] = { 0x01, 0x00, 0x00 };
+    const uint8_t last[]  = { 0x00, 0x00, 0x08 };
+    const uint8_t mixed[] = { 0x2a, 0x15, 0x05 };
+
+    TEST_ASSERT_EQUAL_HEX16(0x7fff, port_pack(all, lens, 3));
+    TEST_ASSERT_EQUAL_HEX16(0x0001, port_pack(first, lens, 3));
+    TEST_ASSERT_EQUAL_HEX16(0x4000, port_pack(last, lens, 3));
+    TEST_ASSERT_EQUAL_HEX16(0x2a | (0x15 << 6) | (0x05 << 11), port_pack(mixed, lens, 3));
+    TEST_ASSERT_EQUAL_HEX16(0x002a, port_pack(mixed, lens, 1));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_wrap);
+    RUN_TEST(test_ring_overflow);
+    RUN_TEST(test_ring_overflow_saturates);
+    RUN_TEST(test_bit_count);
+    RUN_TEST(test_port_field);
+    RUN_TEST(test_port_pack);
+    return UNITY_END();
+}
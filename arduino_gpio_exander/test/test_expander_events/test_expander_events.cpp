@@ -0,0 +1,236 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <unity.h>
+#include "config.h"
+#include "ExpanderEvents.h"
+
+/*
+*****************************************************************************************
+* simulated expander
+*****************************************************************************************
+*/
+// answers the registers the way the I2C request handler of main.cpp fills the Wire buffer
+class SimExpander {
+public:
+    enum : int { kMAX_PENDING = 64 };
+
+    SimExpander(int keys) {
+        _keys = keys;
+        _cnt  = 0;
+        _wake.code = WAKE_KEY_NONE;
+        _wake.ts   = 0;
+    }
+
+    void press(uint8_t pin, bool high, uint16_t ts) {
+        _pending[_cnt].code = pin | (high ? EVENT_EDGE_HIGH : 0);
+        _pending[_cnt].ts   = ts;
+        _cnt++;
+    }
+
+    void wake(uint8_t pin, uint16_t ts) {
+        _wake.code = pin | EVENT_EDGE_HIGH;
+        _wake.ts   = ts;
+    }
+
+    uint8_t pending() { return _cnt; }
+
+    // bytes answered to a read of len after the register write, the master always reads len
+    void read(uint8_t reg, uint8_t param, uint8_t *buf, uint8_t len) {
+        uint8_t pos = 0;
+        uint8_t cnt;
+
+        memset(buf, 0xee, len);
+        switch (reg) {
+            case I2C_REG_GET_EVENT_COUNT:
+                buf[pos++] = _cnt;
+                break;
+
+            case I2C_REG_GET_EVENTS:
+                cnt = (param > 0) ? param : EVENT_BURST_MAX;
+                cnt = (cnt < _cnt) ? cnt : _cnt;
+                cnt = (cnt < EVENT_BURST_MAX) ? cnt : EVENT_BURST_MAX;
+                buf[pos++] = cnt;
+                for (uint8_t i = 0; i < cnt; i++, pos += sizeof(pin_event_t))
+                    memcpy(buf + pos, &_pending[i], sizeof(pin_event_t));
+                memmove(_pending, _pending + cnt, (_cnt - cnt) * sizeof(pin_event_t));
+                _cnt -= cnt;
+                break;
+
+            case I2C_REG_GET_KEY_COUNT:
+                buf[pos++] = _keys;
+                break;
+
+            case I2C_REG_GET_WAKE_KEY:
+                memcpy(buf, &_wake, sizeof(pin_event_t));
+                _wake.code = WAKE_KEY_NONE;
+                break;
+        }
+    }
+
+private:
+    int         _keys;
+    pin_event_t _pending[kMAX_PENDING];
+    uint8_t     _cnt;
+    pin_event_t _wake;
+};
+
+// what GpioExpander::service() does for one device : count, then bursts until it is empty
+static int drain(SimExpander &dev, uint8_t key_base, bool active_high, key_event_t *evts) {
+    uint8_t buf[1 + EXP_EVENT_BURST_MAX * EXP_EVENT_LEN];
+    int     total = 0;
+
+    for (;;) {
+        uint8_t cnt;
+
+        dev.read(EXP_REG_GET_EVENT_COUNT, 0, buf, 1);
+        cnt = (buf[0] < EXP_EVENT_BURST_MAX) ? buf[0] : EXP_EVENT_BURST_MAX;
+        if (cnt == 0)
+            return total;
+        dev.read(EXP_REG_GET_EVENTS, cnt, buf, exp_burst_len(cnt));
+        total += exp_parse_burst(buf, cnt, key_base, active_high, evts + total);
+    }
+}
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// both sides of the wire agree on the register numbers and the event layout
+void test_register_map(void) {
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_SET_POWER_DOWN, EXP_REG_SET_POWER_DOWN);
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_GET_PIN_STATUS, EXP_REG_GET_PIN_STATUS);
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_GET_EVENT_COUNT, EXP_REG_GET_EVENT_COUNT);
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_GET_EVENTS, EXP_REG_GET_EVENTS);
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_SET_DEBOUNCE, EXP_REG_SET_DEBOUNCE);
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_GET_KEY_COUNT, EXP_REG_GET_KEY_COUNT);
+    TEST_ASSERT_EQUAL_UINT8(I2C_REG_GET_WAKE_KEY, EXP_REG_GET_WAKE_KEY);
+    TEST_ASSERT_EQUAL_UINT8(EVENT_BURST_MAX, EXP_EVENT_BURST_MAX);
+    TEST_ASSERT_EQUAL_UINT8(EVENT_PIN_MASK, EXP_EVENT_PIN_MASK);
+    TEST_ASSERT_EQUAL_UINT8(EVENT_EDGE_HIGH, EXP_EVENT_EDGE_HIGH);
+    TEST_ASSERT_EQUAL_UINT8(WAKE_KEY_NONE, EXP_WAKE_KEY_NONE);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(pin_event_t), EXP_EVENT_LEN);
+}
+
+// more events than one burst holds come out in order over several bursts, with the full ts
+void test_burst_decode(void) {
+    SimExpander dev(14);
+    key_event_t evts[SimExpander::kMAX_PENDING];
+
+    for (uint16_t i = 0; i < 25; i++)
+        dev.press(i % 14, (i & 1) == 0, 0xff00 + i * 7);
+    TEST_ASSERT_EQUAL_UINT8(25, drain(dev, 0, true, evts));
+    TEST_ASSERT_EQUAL_UINT8(0, dev.pending());
+
+    for (uint16_t i = 0; i < 25; i++) {
+        TEST_ASSERT_EQUAL_UINT8(i % 14, evts[i].key);
+        TEST_ASSERT_TRUE(evts[i].down == ((i & 1) == 0));
+        TEST_ASSERT_EQUAL_UINT16(0xff00 + i * 7, evts[i].ts);
+    }
+}
+
+// a low going pin is the key-down on boards wired to ground
+void test_active_low(void) {
+    SimExpander dev(14);
+    key_event_t evts[2];
+
+    dev.press(3, false, 10);
+    dev.press(3, true, 90);
+    TEST_ASSERT_EQUAL_UINT8(2, drain(dev, 0, false, evts));
+    TEST_ASSERT_TRUE(evts[0].down);
+    TEST_ASSERT_FALSE(evts[1].down);
+}
+
+// a count byte above the request only gives what was asked for, the rest is not event data
+void test_burst_count_clamp(void) {
+    uint8_t     burst[1 + 2 * EXP_EVENT_LEN] = { 9, 0x81, 0x34, 0x12, 0x02, 0x78, 0x56 };
+    key_event_t evts[EXP_EVENT_BURST_MAX];
+
+    TEST_ASSERT_EQUAL_UINT8(2, exp_parse_burst(burst, 2, 0, true, evts));
+    TEST_ASSERT_EQUAL_UINT8(1, evts[0].key);
+    TEST_ASSERT_TRUE(evts[0].down);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, evts[0].ts);
+    TEST_ASSERT_EQUAL_UINT8(2, evts[1].key);
+    TEST_ASSERT_FALSE(evts[1].down);
+    TEST_ASSERT_EQUAL_HEX16(0x5678, evts[1].ts);
+
+    burst[0] = 1;
+    TEST_ASSERT_EQUAL_UINT8(1, exp_parse_burst(burst, 2, 0, true, evts));
+    burst[0] = 0;
+    TEST_ASSERT_EQUAL_UINT8(0, exp_parse_burst(burst, 2, 0, true, evts));
+}
+
+// a direct device, a matrix one and one that does not report its key count, in address order
+void test_key_base(void) {
+    SimExpander devs[] = { SimExpander(14), SimExpander(MATRIX_ROWS * MATRIX_COLS), SimExpander(0) };
+    uint8_t     key_base[4] = { 0 };
+    key_event_t evts[1];
+    uint8_t     buf[1];
+
+    for (uint8_t d = 0; d < 3; d++) {
+        devs[d].read(EXP_REG_GET_KEY_COUNT, 0, buf, 1);
+        key_base[d + 1] = exp_next_key_base(key_base[d], buf[0]);
+    }
+    TEST_ASSERT_EQUAL_UINT8(14, key_base[1]);
+    TEST_ASSERT_EQUAL_UINT8(63, key_base[2]);
+    TEST_ASSERT_EQUAL_UINT8(63 + EXP_KEYS_PER_DEVICE, key_base[3]);
+    TEST_ASSERT_EQUAL_UINT8(14 + EXP_KEYS_PER_DEVICE, exp_next_key_base(14, -1));
+
+    // the last matrix key of the second device and the first key of the third meet
+    devs[1].press(MATRIX_ROWS * MATRIX_COLS - 1, true, 1);
+    TEST_ASSERT_EQUAL_UINT8(1, drain(devs[1], key_base[1], true, evts));
+    TEST_ASSERT_EQUAL_UINT8(62, evts[0].key);
+    devs[2].press(0, true, 2);
+    TEST_ASSERT_EQUAL_UINT8(1, drain(devs[2], key_base[2], true, evts));
+    TEST_ASSERT_EQUAL_UINT8(63, evts[0].key);
+}
+
+// the latched wake key is read once, a device that was not woken says so
+void test_wake_key(void) {
+    SimExpander dev(14);
+    key_event_t evt;
+    uint8_t     raw[EXP_EVENT_LEN];
+
+    dev.read(EXP_REG_GET_WAKE_KEY, 0, raw, sizeof(raw));
+    TEST_ASSERT_FALSE(exp_parse_wake(raw, 14, true, &evt));
+
+    dev.wake(5, 0xbeef);
+    dev.read(EXP_REG_GET_WAKE_KEY, 0, raw, sizeof(raw));
+    TEST_ASSERT_TRUE(exp_parse_wake(raw, 14, true, &evt));
+    TEST_ASSERT_EQUAL_UINT8(19, evt.key);
+    TEST_ASSERT_TRUE(evt.down);
+    TEST_ASSERT_EQUAL_HEX16(0xbeef, evt.ts);
+
+    dev.read(EXP_REG_GET_WAKE_KEY, 0, raw, sizeof(raw));
+    TEST_ASSERT_FALSE(exp_parse_wake(raw, 14, true, &evt));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_register_map);
+    RUN_TEST(test_burst_decode);
+    RUN_TEST(test_active_low);
+    RUN_TEST(test_burst_count_clamp);
+    RUN_TEST(test_key_base);
+    RUN_TEST(test_wake_key);
+    return UNITY_END();
+}
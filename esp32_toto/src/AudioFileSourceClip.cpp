@@ -0,0 +1,123 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <Arduino.h>
+#include "AudioFileSourceClip.h"
+#include "Metrics.h"
+
+AudioFileSourceClip::AudioFileSourceClip(fs::FS &fs, ClipCache &cache) : fs(fs), cache(cache)
+{
+  entry = NULL;
+  pos = 0;
+  filePos = 0;
+}
+
+AudioFileSourceClip::~AudioFileSourceClip()
+{
+  close();
+}
+
+bool AudioFileSourceClip::open(const char *filename)
+{
+  close();
+  pos = 0;
+
+  entry = cache.take(filename);
+  if (entry) {
+    filePos = entry->ofs + entry->len;
+    return true;
+  }
+
+  f = fs.open(filename);
+  return f;
+}
+
+uint32_t AudioFileSourceClip::read(void *data, uint32_t len)
+{
+  if (!entry) {
+    uint32_t ts = micros();
+    int n = f ? f.read(reinterpret_cast<uint8_t*>(data), len) : 0;
+    METRIC_ADD(MH_SD_READ_US, micros() - ts);
+    if (n > 0) pos += n;
+    return (n > 0) ? n : 0;
+  }
+
+  uint8_t *p = reinterpret_cast<uint8_t*>(data);
+  uint32_t done = 0;
+
+  // the cache holds the start of the PCM, the header in front of it comes from the file
+  if (pos >= entry->ofs && pos < entry->ofs + entry->len) {
+    done = entry->ofs + entry->len - pos;
+    done = (done < len) ? done : len;
+    memcpy(p, entry->buf + pos - entry->ofs, done);
+    pos += done;
+  }
+
+  if (done < len && pos < entry->size) {
+    uint32_t ts = micros();
+    if (filePos != pos && entry->file.seek(pos)) filePos = pos;
+    int n = entry->file.read(p + done, len - done);
+    METRIC_ADD(MH_SD_READ_US, micros() - ts);
+    if (n > 0) {
+      done += n;
+      pos += n;
+      filePos = pos;
+    }
+  }
+  return done;
+}
+
+bool AudioFileSourceClip::seek(int32_t pos, int dir)
+{
+  if (!entry) {
+    if (!f) return false;
+    if (dir == SEEK_CUR) pos += f.position();
+    else if (dir == SEEK_END) pos += f.size();
+    if (!f.seek(pos)) return false;
+    this->pos = pos;
+    return true;
+  }
+
+  // the cached file is only moved when a read goes past the head
+  if (dir == SEEK_CUR) pos += this->pos;
+  else if (dir == SEEK_END) pos += entry->size;
+  if (pos < 0 || (uint32_t)pos > entry->size) return false;
+  this->pos = pos;
+  return true;
+}
+
+bool AudioFileSourceClip::close()
+{
+  if (entry) {
+    cache.release(entry);
+    entry = NULL;
+  }
+  if (f) f.close();
+  return true;
+}
+
+bool AudioFileSourceClip::isOpen()
+{
+  return entry != NULL || f;
+}
+
+uint32_t AudioFileSourceClip::getSize()
+{
+  if (entry) return entry->size;
+  return f ? f.size() : 0;
+}
+
+uint32_t AudioFileSourceClip::getPos()
+{
+  return pos;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <FS.h>
+#include "AudioFileSource.h"
+#include "ClipCache.h"
+
+/*
+ File source that plays a clip out of the ClipCache when its head is prefetched: the
+ first blocks of PCM come from RAM and the rest from the file the cache already holds
+ open. On a miss the file is opened here like AudioFileSourceSD and the clip is
+ queued for prefetch, so the next press of the same key is served from the cache.
+*/
+class AudioFileSourceClip : public AudioFileSource
+{
+  public:
+    AudioFileSourceClip(fs::FS &fs, ClipCache &cache);
+    virtual ~AudioFileSourceClip() override;
+
+    virtual bool open(const char *filename) override;
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override;
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+
+    bool IsCached() { return entry != NULL; }
+
+  protected:
+    fs::FS &fs;
+    ClipCache &cache;
+    cache_entry_t *entry;
+    File f;                                // own file on a miss
+    uint32_t pos;
+    uint32_t filePos;                      // where the cached entry's file is positioned
+};
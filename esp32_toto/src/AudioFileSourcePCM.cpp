@@ -0,0 +1,142 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <Arduino.h>
+#include "AudioFileSourcePCM.h"
+
+static const uint32_t kSTREAM_LEN = 0x7ffffff0;  // a sustained clip ends when its key is let go
+
+AudioFileSourcePCM::AudioFileSourcePCM(AudioFileSource *src)
+{
+  this->src = src;
+  pos = 0;
+  dataPos = 0;
+  sustain = false;
+  memset(&info, 0, sizeof(info));
+}
+
+AudioFileSourcePCM::~AudioFileSourcePCM()
+{
+  close();
+}
+
+bool AudioFileSourcePCM::open(const char *filename)
+{
+  close();
+  if (!src->open(filename)) return false;
+  if (!riff_parse(src, &info)) {
+    src->close();
+    return false;
+  }
+  sustain = false;
+  return SeekData();
+}
+
+bool AudioFileSourcePCM::OpenAt(const char *filename, const wav_info_t *info, bool sustain)
+{
+  close();
+  if (!src->open(filename)) return false;
+  this->info = *info;
+  this->sustain = sustain && info->loop_end > info->loop_start;
+  return SeekData();
+}
+
+bool AudioFileSourcePCM::SeekData()
+{
+  if (!src->seek(info.data_ofs, SEEK_SET)) {
+    src->close();
+    return false;
+  }
+  // a sustained clip is open ended like a sentence, the generator stops on the first
+  // empty read after the release tail
+  riff_make_header(&info, sustain ? kSTREAM_LEN : info.data_len, header);
+  loopStart = info.loop_start * info.align;
+  loopEnd = info.loop_end * info.align;
+  pos = 0;
+  dataPos = 0;
+  return true;
+}
+
+uint32_t AudioFileSourcePCM::read(void *data, uint32_t len)
+{
+  uint8_t *p = reinterpret_cast<uint8_t*>(data);
+  uint32_t done = 0;
+
+  if (pos < WAV_HEADER_LEN) {
+    done = WAV_HEADER_LEN - pos;
+    done = (done < len) ? done : len;
+    memcpy(p, header + pos, done);
+    pos += done;
+  }
+
+  // the source sits on the sample at dataPos, the header does not move it
+  while (done < len) {
+    uint32_t end = sustain ? loopEnd : info.data_len;
+
+    if (dataPos >= end) {
+      if (!sustain) break;
+      // back to the loop start for as long as the key is held
+      if (!src->seek(info.data_ofs + loopStart, SEEK_SET)) {
+        sustain = false;
+        break;
+      }
+      dataPos = loopStart;
+      continue;
+    }
+
+    uint32_t want = (len - done < end - dataPos) ? len - done : end - dataPos;
+    uint32_t n = src->read(p + done, want);
+    if (n == 0) break;
+    done += n;
+    pos += n;
+    dataPos += n;
+  }
+  return done;
+}
+
+bool AudioFileSourcePCM::seek(int32_t pos, int dir)
+{
+  // a loop has no fixed length to seek in
+  if (sustain) return false;
+
+  if (dir == SEEK_CUR) pos += this->pos;
+  else if (dir == SEEK_END) pos += WAV_HEADER_LEN + info.data_len;
+  if (pos < 0 || (uint32_t)pos > WAV_HEADER_LEN + info.data_len) return false;
+
+  uint32_t data = ((uint32_t)pos > WAV_HEADER_LEN) ? pos - WAV_HEADER_LEN : 0;
+  if (!src->seek(info.data_ofs + data, SEEK_SET)) return false;
+  this->pos = pos;
+  dataPos = data;
+  return true;
+}
+
+bool AudioFileSourcePCM::close()
+{
+  sustain = false;
+  return src->close();
+}
+
+bool AudioFileSourcePCM::isOpen()
+{
+  return src->isOpen();
+}
+
+uint32_t AudioFileSourcePCM::getSize()
+{
+  return WAV_HEADER_LEN + (sustain ? kSTREAM_LEN : info.data_len);
+}
+
+uint32_t AudioFileSourcePCM::getPos()
+{
+  return pos;
+}
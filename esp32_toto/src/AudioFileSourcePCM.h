@@ -0,0 +1,44 @@
+#pragma once
+
+#include "AudioFileSource.h"
+#include "RiffParser.h"
+
+/*
+ Presents the PCM of a clip behind a canonical 44 byte header, over any other source.
+ With the data offset and format from the library index the open seeks straight to the
+ samples: no chunk walk on the card, and AudioGeneratorWAV only reads the header from
+ RAM. Without them the clip is parsed once here, so extended headers (LIST, fact,
+ WAVE_FORMAT_EXTENSIBLE, ...) play as well.
+ A clip opened to sustain repeats its smpl loop until Release(), then plays the rest of
+ the file after the loop as its release tail.
+*/
+class AudioFileSourcePCM : public AudioFileSource
+{
+  public:
+    AudioFileSourcePCM(AudioFileSource *src);
+    virtual ~AudioFileSourcePCM() override;
+
+    virtual bool open(const char *filename) override;
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override;
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+
+    bool OpenAt(const char *filename, const wav_info_t *info, bool sustain = false);
+    void Release() { sustain = false; }
+    bool IsSustained() { return sustain; }
+
+  protected:
+    bool SeekData();
+
+    AudioFileSource *src;
+    wav_info_t info;
+    uint32_t pos;
+    uint32_t dataPos;                      // PCM bytes into the data chunk
+    uint32_t loopStart;                    // bytes
+    uint32_t loopEnd;
+    bool     sustain;
+    uint8_t  header[WAV_HEADER_LEN];
+};
@@ -0,0 +1,250 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <Arduino.h>
+#include "AudioFileSourcePhrase.h"
+
+static const uint32_t kSTREAM_LEN = 0x7ffffff0;  // sentence length is not known up front
+
+AudioFileSourcePhrase::AudioFileSourcePhrase(AudioFileSource *a, AudioFileSource *b)
+{
+  slots[0].src = a;
+  slots[1].src = b;
+  count = 0;
+  gapMs = 0;
+  state = kIDLE;
+  playing = -1;
+  cur = 0;
+  slots[0].ready = slots[1].ready = false;
+}
+
+AudioFileSourcePhrase::~AudioFileSourcePhrase()
+{
+  close();
+}
+
+bool AudioFileSourcePhrase::Add(const char *path, uint8_t gainF2P6, const wav_info_t *info)
+{
+  if (count >= kMAX_WORDS) return false;
+  strncpy(paths[count], path, kPATH_LEN - 1);
+  paths[count][kPATH_LEN - 1] = 0;
+  gains[count] = gainF2P6;
+  if (info) infos[count] = *info;
+  else infos[count].data_ofs = 0;
+  count++;
+  return true;
+}
+
+void AudioFileSourcePhrase::Clear()
+{
+  close();
+  count = 0;
+}
+
+bool AudioFileSourcePhrase::OpenClip(slot_t *slot, int idx)
+{
+  wav_info_t info = infos[idx];
+
+  slot->ready = false;
+  AudioFileSource *f = slot->src;
+  if (!f->open(paths[idx])) return false;
+
+  // the generator only ever sees our own header, the clip's is skipped
+  if ((!info.data_ofs && !riff_parse(f, &info)) || !f->seek(info.data_ofs, SEEK_SET)) {
+    audioLogger->printf("phrase: skip %s, no PCM\n", paths[idx]);
+    f->close();
+    return false;
+  }
+
+  // the first word sets the stream format
+  if (rate == 0) {
+    rate = info.rate;
+    channels = info.channels;
+    bits = info.bits;
+  }
+  if (info.format != WAVE_FORMAT_PCM || info.bits != 16 || info.rate != rate || info.channels != channels) {
+    audioLogger->printf("phrase: skip %s (%u Hz %u ch %u bit)\n", paths[idx], (unsigned)info.rate, info.channels,
+                        info.bits);
+    f->close();
+    return false;
+  }
+
+  slot->left = info.data_len & ~1;
+  slot->gain = gains[idx];
+  slot->word = idx;
+  slot->bufPos = 0;
+  slot->bufLen = f->read(slot->buf, (slot->left < (uint32_t)kPRELOAD) ? slot->left : kPRELOAD) & ~1;
+  slot->left -= slot->bufLen;
+  slot->ready = true;
+  return true;
+}
+
+bool AudioFileSourcePhrase::PrepareNext(slot_t *slot)
+{
+  while (nextIdx < count) {
+    if (OpenClip(slot, nextIdx++)) return true;
+  }
+  return false;
+}
+
+bool AudioFileSourcePhrase::Start()
+{
+  close();
+  nextIdx = 0;
+  rate = 0;
+  cur = 0;
+  if (!PrepareNext(&slots[cur])) return false;
+  playing = slots[cur].word;
+
+  // canonical 44 byte header, open ended data chunk
+  wav_info_t fmt;
+  fmt.format = WAVE_FORMAT_PCM;
+  fmt.channels = channels;
+  fmt.rate = rate;
+  fmt.bits = bits;
+  fmt.align = channels * bits / 8;
+  riff_make_header(&fmt, kSTREAM_LEN, header);
+
+  pos = 0;
+  state = kHEADER;
+  return true;
+}
+
+// called from the main loop, keeps the file open and header walk off the sample path
+void AudioFileSourcePhrase::Preload()
+{
+  slot_t *next = &slots[cur ^ 1];
+
+  if (state == kIDLE || state == kEND || next->ready) return;
+  PrepareNext(next);
+}
+
+bool AudioFileSourcePhrase::SwitchNext()
+{
+  slot_t *next = &slots[cur ^ 1];
+
+  // not preloaded in time, open it here rather than drop the word
+  if (!next->ready && !PrepareNext(next)) {
+    state = kEND;
+    return false;
+  }
+  cur ^= 1;
+  playing = next->word;
+  state = kDATA;
+  return true;
+}
+
+void AudioFileSourcePhrase::EndClip()
+{
+  slots[cur].src->close();
+  slots[cur].ready = false;
+
+  if (gapMs > 0 && (slots[cur ^ 1].ready || nextIdx < count)) {
+    gapLeft = (rate * gapMs / 1000) * channels * (bits / 8);
+    state = kGAP;
+  } else {
+    SwitchNext();
+  }
+}
+
+uint32_t AudioFileSourcePhrase::ReadClip(uint8_t *p, uint32_t len)
+{
+  slot_t  *s = &slots[cur];
+  uint32_t n = 0;
+
+  len &= ~1;
+  if (s->bufPos < s->bufLen) {
+    n = s->bufLen - s->bufPos;
+    n = (n < len) ? n : len;
+    memcpy(p, s->buf + s->bufPos, n);
+    s->bufPos += n;
+  } else if (s->left > 0) {
+    n = s->src->read(p, (s->left < len) ? s->left : len) & ~1;
+    s->left = (n > 0) ? s->left - n : 0;
+  }
+
+  if (s->gain != kGAIN_UNITY) {
+    for (uint32_t i = 0; i < n; i += 2) {
+      int32_t v = (int16_t)(p[i] | (p[i + 1] << 8));
+      v = constrain((v * s->gain) >> 6, -32767, 32767);
+      p[i] = v;
+      p[i + 1] = v >> 8;
+    }
+  }
+  return n;
+}
+
+uint32_t AudioFileSourcePhrase::read(void *data, uint32_t len)
+{
+  uint8_t *p = (uint8_t *)data;
+  uint32_t done = 0;
+
+  while (done < len) {
+    uint32_t n = 0;
+
+    if (state == kHEADER) {
+      n = sizeof(header) - pos;
+      n = (n < len - done) ? n : len - done;
+      memcpy(p + done, header + pos, n);
+      if (pos + n == sizeof(header)) state = kDATA;
+    } else if (len - done < 2) {
+      break;
+    } else if (state == kDATA) {
+      n = ReadClip(p + done, len - done);
+      if (n == 0) EndClip();
+    } else if (state == kGAP) {
+      n = (gapLeft < len - done) ? gapLeft : (len - done) & ~1;
+      memset(p + done, 0, n);
+      gapLeft -= n;
+      if (gapLeft == 0) SwitchNext();
+    } else {
+      break;
+    }
+    done += n;
+    pos += n;
+  }
+  return done;
+}
+
+bool AudioFileSourcePhrase::seek(int32_t pos, int dir)
+{
+  (void)pos;
+  (void)dir;
+  return false;
+}
+
+bool AudioFileSourcePhrase::close()
+{
+  for (int i = 0; i < 2; i++) {
+    if (slots[i].ready) slots[i].src->close();
+    slots[i].ready = false;
+  }
+  state = kIDLE;
+  playing = -1;
+  return true;
+}
+
+bool AudioFileSourcePhrase::isOpen()
+{
+  return state != kIDLE;
+}
+
+uint32_t AudioFileSourcePhrase::getSize()
+{
+  return kSTREAM_LEN + sizeof(header);
+}
+
+uint32_t AudioFileSourcePhrase::getPos()
+{
+  return pos;
+}
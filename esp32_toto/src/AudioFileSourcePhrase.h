@@ -0,0 +1,79 @@
+#pragma once
+
+#include "AudioFileSource.h"
+#include "RiffParser.h"
+
+/*
+ Plays a queue of word clips as one gapless WAV stream.
+ A canonical header built from the first clip is followed by the PCM of every queued
+ clip (each scaled by its own normalisation gain) with an optional silent gap in between,
+ so a single AudioGeneratorWAV runs the whole sentence.
+ Preload() opens the next clip, seeks to its PCM and reads its first block while the
+ current one plays; it is called from the main loop and never from read(). Words added
+ with their wav_info_t (from the library index) are not parsed again.
+ The two sources take turns, one reads the current word while the other one opens the next.
+ Clips have to share the sample format of the first one, the others are skipped.
+*/
+class AudioFileSourcePhrase : public AudioFileSource
+{
+  public:
+    enum : int { kMAX_WORDS = 16,
+                 kPRELOAD = 512,           // bytes of PCM read with the header
+                 kPATH_LEN = 64,
+                 kGAIN_UNITY = 1 << 6 };
+
+    AudioFileSourcePhrase(AudioFileSource *a, AudioFileSource *b);
+    virtual ~AudioFileSourcePhrase() override;
+
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override;
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+
+    bool Add(const char *path, uint8_t gainF2P6, const wav_info_t *info = NULL);
+    void Clear();
+    void SetGap(int ms) { gapMs = ms; }
+    bool Start();
+    void Preload();
+    int  GetCount() { return count; }
+    int  GetPlaying() { return playing; }
+
+  protected:
+    enum : int { kIDLE = 0, kHEADER, kDATA, kGAP, kEND };
+
+    typedef struct {
+      AudioFileSource *src;
+      uint32_t left;                       // PCM bytes not yet taken from the file
+      uint8_t  gain;                       // 2.6 fixed point, kGAIN_UNITY = 1.0
+      uint8_t  buf[kPRELOAD];
+      uint16_t bufLen;
+      uint16_t bufPos;
+      int      word;
+      bool     ready;
+    } slot_t;
+
+    bool     OpenClip(slot_t *slot, int idx);
+    bool     PrepareNext(slot_t *slot);
+    bool     SwitchNext();
+    uint32_t ReadClip(uint8_t *p, uint32_t len);
+    void     EndClip();
+
+    char     paths[kMAX_WORDS][kPATH_LEN];
+    uint8_t  gains[kMAX_WORDS];
+    wav_info_t infos[kMAX_WORDS];          // data_ofs 0 : parse on open
+    int      count;
+    int      nextIdx;                      // first word not opened yet
+    int      playing;                      // word being read, -1 before the first
+    slot_t   slots[2];
+    int      cur;
+    int      state;
+    int      gapMs;
+    uint32_t gapLeft;
+    uint32_t pos;
+    uint32_t rate;
+    uint16_t channels;
+    uint16_t bits;
+    uint8_t  header[WAV_HEADER_LEN];
+};
@@ -0,0 +1,587 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <Arduino.h>
+#include "AudioGeneratorTracker.h"
+
+static const uint32_t kPAULA_HZ     = 3546895;  // PAL Amiga, a period is this clock over the sample rate
+static const int      kROWS         = 64;
+static const int      kHEADER_LEN   = 1084;     // title, 31 sample headers, order table and tag
+static const int16_t  kPERIOD_MIN   = 113;      // B-3, portamento limits
+static const int16_t  kPERIOD_MAX   = 856;      // C-1
+static const int16_t  kPERIOD_LOW   = 28;       // anything shorter is not played
+
+// 2^(-finetune / 96) in Q16, finetune 0..7 then -8..-1
+static const uint32_t kFINETUNE[16] = {
+  65536, 65065, 64596, 64132, 63670, 63212, 62757, 62306,
+  69433, 68933, 68438, 67945, 67456, 66971, 66489, 66011,
+};
+
+// 2^(-semitones / 12) in Q16, arpeggio
+static const uint32_t kSEMITONE[16] = {
+  65536, 61858, 58386, 55109, 52016, 49097, 46341, 43740,
+  41285, 38968, 36781, 34716, 32768, 30929, 29193, 27554,
+};
+
+// ProTracker vibrato and tremolo, the second half of the wave is the first negated
+static const uint8_t kSINE[32] = {
+  0,   24,  49,  74,  97,  120, 141, 161, 180, 197, 212, 224, 235, 244, 250, 253,
+  255, 253, 250, 244, 235, 224, 212, 197, 180, 161, 141, 120, 97,  74,  49,  24,
+};
+
+static inline uint16_t getBE16(const uint8_t *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline int16_t tune(int16_t period, const uint32_t *tbl, uint8_t idx)
+{
+  return ((int32_t)period * tbl[idx & 0x0f] + 32768) >> 16;
+}
+
+AudioGeneratorTracker::AudioGeneratorTracker(const uint8_t *mod, uint32_t len)
+{
+  this->mod = mod;
+  modLen = len;
+  rate = 22050;
+  repeat = true;
+  running = false;
+  file = NULL;
+  output = NULL;
+  title[0] = 0;
+  channels = 0;
+}
+
+AudioGeneratorTracker::~AudioGeneratorTracker() {}
+
+bool AudioGeneratorTracker::Load()
+{
+  const uint8_t *tag = mod + 1080;
+  uint32_t ofs;
+  uint8_t pats = 0;
+
+  if (!mod || modLen < (uint32_t)kHEADER_LEN)
+    return false;
+
+  if (!memcmp(tag, "M.K.", 4) || !memcmp(tag, "M!K!", 4) || !memcmp(tag, "FLT4", 4) || !memcmp(tag, "4CHN", 4))
+    channels = 4;
+  else if (!memcmp(tag, "6CHN", 4))
+    channels = 6;
+  else if (!memcmp(tag, "8CHN", 4) || !memcmp(tag, "FLT8", 4) || !memcmp(tag, "OCTA", 4))
+    channels = 8;
+  else
+    return false;
+
+  memcpy(title, mod, 20);
+  title[20] = 0;
+  songLen = mod[950];
+  restart = mod[951];
+  orders = mod + 952;
+  if (songLen == 0 || songLen > 128)
+    return false;
+
+  // unused patterns in the table are stored too
+  for (int i = 0; i < 128; i++)
+    pats = max(pats, orders[i]);
+  patterns = mod + kHEADER_LEN;
+  ofs = kHEADER_LEN + (pats + 1) * kROWS * channels * 4;
+  if (ofs > modLen)
+    return false;
+
+  // sample data follows the patterns, a module cut short loses the end of its last samples
+  for (int i = 0; i < kSAMPLES; i++) {
+    const uint8_t *h = mod + 20 + i * 30;
+    Sample *s = &samples[i];
+    uint32_t len = getBE16(h + 22) * 2;
+    uint32_t loopStart = getBE16(h + 26) * 2;
+    uint32_t loopLen = getBE16(h + 28) * 2;
+
+    s->data = (const int8_t *)(mod + ofs);
+    s->len = (ofs + len <= modLen) ? len : (ofs < modLen) ? modLen - ofs : 0;
+    s->finetune = h[24] & 0x0f;
+    s->volume = min(h[25], (uint8_t)64);
+    s->loopStart = 0;
+    s->loopLen = 0;
+    if (loopLen > 2 && loopStart < s->len) {
+      s->loopStart = loopStart;
+      s->loopLen = min(loopLen, s->len - loopStart);
+    }
+    if (!s->len)
+      s->data = NULL;
+    ofs += len;
+  }
+
+  memset(chans, 0, sizeof(chans));
+  order = 0;
+  row = 0;
+  tick = 0;
+  speed = 6;
+  tempo = 125;
+  tickFrames = rate * 5 / (2 * tempo);
+  tickLeft = 0;
+  rowDelay = 0;
+  delayed = false;
+  jumpOrder = -1;
+  ended = false;
+  buffLen = 0;
+  buffPos = 0;
+  loadUs = 0;
+  loadFrames = 0;
+  load = 0;
+  return true;
+}
+
+bool AudioGeneratorTracker::begin(AudioFileSource *source, AudioOutput *output)
+{
+  (void)source;
+  if (!output || !Load())
+    return false;
+
+  this->output = output;
+  output->SetRate(rate);
+  output->SetBitsPerSample(16);
+  output->SetChannels(2);
+  if (!output->begin())
+    return false;
+  running = true;
+  return true;
+}
+
+bool AudioGeneratorTracker::loop()
+{
+  if (!running)
+    goto done;
+
+  // what the output did not take is offered again on the next call
+  while (true) {
+    if (buffPos >= buffLen && !RenderBlock()) {
+      stop();
+      break;
+    }
+    if (!output->ConsumeSample(&buff[buffPos * 2]))
+      break;
+    buffPos++;
+  }
+
+done:
+  if (output)
+    output->loop();
+  return running;
+}
+
+bool AudioGeneratorTracker::stop()
+{
+  if (!running)
+    return true;
+  running = false;
+  output->stop();
+  return true;
+}
+
+uint16_t AudioGeneratorTracker::Bench(uint32_t ms)
+{
+  uint32_t frames = (uint64_t)ms * rate / 1000;
+  uint32_t done = 0;
+  uint32_t ts;
+
+  if (!Load())
+    return 0;
+  ts = micros();
+  while (done < frames && RenderBlock())
+    done += buffLen;
+  ts = micros() - ts;
+  return done ? (uint64_t)ts * rate / ((uint64_t)done * 1000) : 0;
+}
+
+bool AudioGeneratorTracker::RenderBlock()
+{
+  int32_t acc[kBLOCK * 2];
+  uint32_t ts = micros();
+  int shift = (channels <= 4) ? 1 : 2;      // two more channels a side, one more bit
+  int n = 0;
+
+  memset(acc, 0, sizeof(acc));
+  while (n < kBLOCK) {
+    if (tickLeft == 0) {
+      if (!Tick())
+        break;
+      tickLeft = tickFrames;
+    }
+    int cnt = min((uint32_t)(kBLOCK - n), tickLeft);
+    Mix(acc + n * 2, cnt);
+    n += cnt;
+    tickLeft -= cnt;
+  }
+
+  // Amiga panning is hard left / right, a quarter of each side goes to the other one
+  for (int i = 0; i < n; i++) {
+    int32_t l = (acc[i * 2] * 3 + acc[i * 2 + 1]) >> shift;
+    int32_t r = (acc[i * 2 + 1] * 3 + acc[i * 2]) >> shift;
+
+    buff[i * 2] = (l > 32767) ? 32767 : (l < -32768) ? -32768 : l;
+    buff[i * 2 + 1] = (r > 32767) ? 32767 : (r < -32768) ? -32768 : r;
+  }
+  buffLen = n;
+  buffPos = 0;
+
+  loadUs += micros() - ts;
+  loadFrames += n;
+  if (loadFrames >= (uint32_t)rate) {
+    load = (uint64_t)loadUs * rate / ((uint64_t)loadFrames * 1000);
+    loadUs = 0;
+    loadFrames = 0;
+  }
+  return n > 0;
+}
+
+void AudioGeneratorTracker::Mix(int32_t *acc, int frames)
+{
+  for (int c = 0; c < channels; c++) {
+    Channel *ch = &chans[c];
+    const int8_t *d = ch->data;
+    uint32_t pos = ch->pos;
+    uint32_t frac = ch->frac;
+    uint32_t step = ch->step;
+    int32_t vol = ch->mixVol;
+    int32_t *a = acc + (((c & 3) == 0 || (c & 3) == 3) ? 0 : 1);
+
+    if (!d)
+      continue;
+
+    if (vol == 0) {
+      // only the position moves
+      frac += step * frames;
+      pos += frac >> 16;
+      frac &= 0xffff;
+    } else {
+      for (int i = 0; i < frames; i++) {
+        a[i * 2] += d[pos] * vol;
+        frac += step;
+        pos += frac >> 16;
+        frac &= 0xffff;
+        if (pos >= ch->end) {
+          if (!ch->loopLen) {
+            d = NULL;
+            break;
+          }
+          pos = ch->end - ch->loopLen + (pos - ch->end) % ch->loopLen;
+        }
+      }
+    }
+    if (d && pos >= ch->end) {
+      if (ch->loopLen)
+        pos = ch->end - ch->loopLen + (pos - ch->end) % ch->loopLen;
+      else
+        d = NULL;
+    }
+    ch->data = d;
+    ch->pos = pos;
+    ch->frac = frac;
+  }
+}
+
+bool AudioGeneratorTracker::Tick()
+{
+  if (ended)
+    return false;
+
+  if (tick == 0 && !delayed) {
+    PlayRow();
+  } else {
+    for (int c = 0; c < channels; c++)
+      TickEffect(&chans[c]);
+  }
+
+  if (++tick >= speed) {
+    tick = 0;
+    if (rowDelay) {
+      rowDelay--;
+      delayed = true;
+    } else {
+      delayed = false;
+      NextRow();
+    }
+  }
+  return true;
+}
+
+void AudioGeneratorTracker::NextRow()
+{
+  if (jumpOrder >= 0) {
+    order = jumpOrder;
+    row = jumpRow;
+    jumpOrder = -1;
+  } else if (++row >= kROWS) {
+    row = 0;
+    order++;
+  }
+  if (order >= songLen) {
+    order = (restart < songLen) ? restart : 0;
+    ended = !repeat;
+  }
+}
+
+void AudioGeneratorTracker::PlayRow()
+{
+  const uint8_t *p = patterns + ((uint32_t)orders[order] * kROWS + row) * channels * 4;
+
+  for (int c = 0; c < channels; c++, p += 4) {
+    Channel *ch = &chans[c];
+    uint8_t smp = (p[0] & 0xf0) | (p[2] >> 4);
+    int16_t period = ((p[0] & 0x0f) << 8) | p[1];
+
+    ch->effect = p[2] & 0x0f;
+    ch->param = p[3];
+    if (smp && smp <= kSAMPLES) {
+      ch->sample = smp;
+      ch->volume = samples[smp - 1].volume;
+      ch->finetune = samples[smp - 1].finetune;
+    }
+    if (ch->effect == 0x0e && (ch->param >> 4) == 0x05)
+      ch->finetune = ch->param & 0x0f;
+
+    ch->note = 0;
+    if (period) {
+      period = tune(period, kFINETUNE, ch->finetune);
+      if (ch->effect == 0x03 || ch->effect == 0x05) {
+        ch->target = period;
+      } else if (ch->effect == 0x0e && (ch->param >> 4) == 0x0d && (ch->param & 0x0f)) {
+        ch->note = period;
+      } else {
+        ch->period = period;
+        Trigger(ch);
+      }
+    }
+    RowEffect(ch);
+    ch->mixVol = ch->volume;
+    SetPeriod(ch, ch->period);
+  }
+}
+
+void AudioGeneratorTracker::Trigger(Channel *ch)
+{
+  Sample *s = ch->sample ? &samples[ch->sample - 1] : NULL;
+
+  if (!s || !s->data) {
+    ch->data = NULL;
+    return;
+  }
+  if (ch->effect == 0x09 && ch->param)
+    ch->offset = ch->param;
+
+  ch->data = s->data;
+  ch->loopLen = s->loopLen;
+  ch->end = s->loopLen ? s->loopStart + s->loopLen : s->len;
+  ch->pos = (ch->effect == 0x09) ? ch->offset * 256 : 0;
+  ch->frac = 0;
+  ch->vibPos = 0;
+  ch->tremPos = 0;
+  if (ch->pos >= ch->end) {
+    if (ch->loopLen)
+      ch->pos = s->loopStart;
+    else
+      ch->data = NULL;
+  }
+}
+
+void AudioGeneratorTracker::SetPeriod(Channel *ch, int16_t period)
+{
+  ch->step = (period >= kPERIOD_LOW) ? ((uint64_t)kPAULA_HZ << 16) / ((uint32_t)period * rate) : 0;
+}
+
+void AudioGeneratorTracker::VolumeSlide(Channel *ch, uint8_t param)
+{
+  if (param >> 4)
+    ch->volume = min(ch->volume + (param >> 4), 64);
+  else
+    ch->volume = max(ch->volume - (param & 0x0f), 0);
+}
+
+// tick 0 of a row
+void AudioGeneratorTracker::RowEffect(Channel *ch)
+{
+  uint8_t x = ch->param >> 4;
+  uint8_t y = ch->param & 0x0f;
+
+  switch (ch->effect) {
+    case 0x03:
+      if (ch->param)
+        ch->portaSpeed = ch->param;
+      break;
+
+    case 0x04:
+      if (x)
+        ch->vibrato = (ch->vibrato & 0x0f) | (x << 4);
+      if (y)
+        ch->vibrato = (ch->vibrato & 0xf0) | y;
+      break;
+
+    case 0x07:
+      if (x)
+        ch->tremolo = (ch->tremolo & 0x0f) | (x << 4);
+      if (y)
+        ch->tremolo = (ch->tremolo & 0xf0) | y;
+      break;
+
+    case 0x0b:
+      jumpOrder = ch->param;
+      jumpRow = 0;
+      break;
+
+    case 0x0c:
+      ch->volume = min(ch->param, (uint8_t)64);
+      break;
+
+    case 0x0d:
+      if (jumpOrder < 0)
+        jumpOrder = order + 1;
+      jumpRow = x * 10 + y;
+      if (jumpRow >= kROWS)
+        jumpRow = 0;
+      break;
+
+    case 0x0e:
+      switch (x) {
+        case 0x01:
+          ch->period = max((int16_t)(ch->period - y), kPERIOD_MIN);
+          break;
+
+        case 0x02:
+          ch->period = min((int16_t)(ch->period + y), kPERIOD_MAX);
+          break;
+
+        case 0x06:
+          if (y == 0) {
+            ch->loopRow = row;
+          } else if (ch->loopCnt == 0 || --ch->loopCnt > 0) {
+            if (ch->loopCnt == 0)
+              ch->loopCnt = y;
+            jumpOrder = order;
+            jumpRow = ch->loopRow;
+          }
+          break;
+
+        case 0x0a:
+          ch->volume = min(ch->volume + y, 64);
+          break;
+
+        case 0x0b:
+          ch->volume = max(ch->volume - y, 0);
+          break;
+
+        case 0x0c:
+          if (y == 0)
+            ch->volume = 0;
+          break;
+
+        case 0x0e:
+          if (!delayed)
+            rowDelay = y;
+          break;
+      }
+      break;
+
+    case 0x0f:
+      if (ch->param == 0)
+        break;
+      if (ch->param < 32) {
+        speed = ch->param;
+      } else {
+        tempo = ch->param;
+        tickFrames = rate * 5 / (2 * tempo);
+      }
+      break;
+  }
+}
+
+// every later tick of a row
+void AudioGeneratorTracker::TickEffect(Channel *ch)
+{
+  int16_t period = ch->period;
+  int8_t volume = ch->volume;
+  uint8_t y = ch->param & 0x0f;
+  int16_t delta;
+
+  switch (ch->effect) {
+    case 0x00:
+      if (ch->param && tick % 3)
+        period = tune(period, kSEMITONE, (tick % 3 == 1) ? ch->param >> 4 : y);
+      break;
+
+    case 0x01:
+      ch->period = period = max((int16_t)(period - ch->param), kPERIOD_MIN);
+      break;
+
+    case 0x02:
+      ch->period = period = min((int16_t)(period + ch->param), kPERIOD_MAX);
+      break;
+
+    case 0x03:
+    case 0x05:
+      if (ch->target) {
+        if (period < ch->target)
+          period = min((int16_t)(period + ch->portaSpeed), ch->target);
+        else
+          period = max((int16_t)(period - ch->portaSpeed), ch->target);
+        ch->period = period;
+      }
+      if (ch->effect == 0x05)
+        VolumeSlide(ch, ch->param);
+      volume = ch->volume;
+      break;
+
+    case 0x04:
+    case 0x06:
+      delta = (kSINE[ch->vibPos & 31] * (ch->vibrato & 0x0f)) >> 7;
+      period += (ch->vibPos & 32) ? -delta : delta;
+      ch->vibPos = (ch->vibPos + (ch->vibrato >> 4)) & 63;
+      if (ch->effect == 0x06)
+        VolumeSlide(ch, ch->param);
+      volume = ch->volume;
+      break;
+
+    case 0x07:
+      delta = (kSINE[ch->tremPos & 31] * (ch->tremolo & 0x0f)) >> 6;
+      volume = constrain(volume + ((ch->tremPos & 32) ? -delta : delta), 0, 64);
+      ch->tremPos = (ch->tremPos + (ch->tremolo >> 4)) & 63;
+      break;
+
+    case 0x0a:
+      VolumeSlide(ch, ch->param);
+      volume = ch->volume;
+      break;
+
+    case 0x0e:
+      switch (ch->param >> 4) {
+        case 0x09:
+          if (y && tick % y == 0)
+            Trigger(ch);
+          break;
+
+        case 0x0c:
+          if (tick == y)
+            ch->volume = volume = 0;
+          break;
+
+        case 0x0d:
+          if (tick == y && ch->note) {
+            ch->period = period = ch->note;
+            Trigger(ch);
+          }
+          break;
+      }
+      break;
+  }
+  ch->mixVol = volume;
+  SetPeriod(ch, period);
+}
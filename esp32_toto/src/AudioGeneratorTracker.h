@@ -0,0 +1,126 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "AudioGenerator.h"
+
+/*
+ ProTracker MOD player for background music under the word voices.
+ The module is played in place from a const array in flash, patterns and samples are
+ never copied, so the only RAM is the channel state and one block of kBLOCK frames.
+ Channels are mixed in fixed point (16.16 phase, int32 sums, no interpolation) and the
+ block goes to its output, a mixer input like any word voice. The file source of begin()
+ is not used.
+*/
+class AudioGeneratorTracker : public AudioGenerator
+{
+  public:
+    enum : int { kMAX_CHANNELS = 8, kSAMPLES = 31, kBLOCK = 64 };    // frames, ~2.9ms at 22050Hz
+
+    AudioGeneratorTracker(const uint8_t *mod, uint32_t len);
+    virtual ~AudioGeneratorTracker() override;
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+    virtual bool loop() override;
+    virtual bool stop() override;
+    virtual bool isRunning() override { return running; }
+
+    bool Load();                                         // parses the module, back to its start
+    void SetSampleRate(int hz) { rate = hz; }
+    void SetLoop(bool loop) { repeat = loop; }            // restart the song at its end
+    uint16_t GetLoad() { return load; }                   // render time against the audio, 1/1000
+    uint16_t Bench(uint32_t ms);                           // renders ms of the song flat out, 1/1000
+    const char *GetTitle() { return title; }
+
+  protected:
+    typedef struct {
+      const int8_t *data;
+      uint32_t len;                        // frames
+      uint32_t loopStart;
+      uint32_t loopLen;                    // 0 : played once
+      uint8_t  finetune;
+      uint8_t  volume;
+    } Sample;
+
+    typedef struct {
+      // mixer
+      const int8_t *data;                  // NULL while silent
+      uint32_t pos;                        // frame
+      uint32_t frac;                       // 16 bit fraction of pos
+      uint32_t step;                       // 16.16 frames per output frame
+      uint32_t end;
+      uint32_t loopLen;
+      uint8_t  mixVol;                     // 0..64 after tremolo
+      // player
+      uint8_t  sample;                     // 1..kSAMPLES, 0 : none yet
+      uint8_t  finetune;
+      int8_t   volume;
+      int16_t  period;
+      int16_t  target;                     // tone portamento
+      int16_t  note;                       // period of a delayed note
+      uint8_t  effect;
+      uint8_t  param;
+      uint8_t  portaSpeed;
+      uint8_t  vibrato;
+      uint8_t  vibPos;
+      uint8_t  tremolo;
+      uint8_t  tremPos;
+      uint8_t  offset;
+      uint8_t  loopRow;
+      uint8_t  loopCnt;
+    } Channel;
+
+    bool RenderBlock();
+    bool Tick();
+    void PlayRow();
+    void NextRow();
+    void RowEffect(Channel *ch);
+    void TickEffect(Channel *ch);
+    void Trigger(Channel *ch);
+    void SetPeriod(Channel *ch, int16_t period);
+    void VolumeSlide(Channel *ch, uint8_t param);
+    void Mix(int32_t *acc, int frames);
+
+    const uint8_t *mod;
+    uint32_t modLen;
+    const uint8_t *orders;
+    const uint8_t *patterns;
+    char     title[21];
+    uint8_t  songLen;
+    uint8_t  restart;
+    uint8_t  channels;
+    Sample   samples[kSAMPLES];
+    Channel  chans[kMAX_CHANNELS];
+
+    int      rate;
+    bool     repeat;
+    bool     ended;
+    uint8_t  order;
+    uint8_t  row;
+    uint8_t  tick;
+    uint8_t  speed;                        // ticks per row
+    uint8_t  tempo;                        // BPM, a tick is 2.5 / tempo seconds
+    uint8_t  rowDelay;                     // EEx repeats left
+    bool     delayed;                      // the row is played again, no new notes
+    int16_t  jumpOrder;                    // Bxx / Dxx / E6x, -1 : none
+    uint8_t  jumpRow;
+    uint32_t tickFrames;
+    uint32_t tickLeft;
+
+    int16_t  buff[kBLOCK * 2];
+    int      buffLen;
+    int      buffPos;
+    uint32_t loadUs;
+    uint32_t loadFrames;
+    uint16_t load;
+};
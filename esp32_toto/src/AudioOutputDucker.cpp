@@ -0,0 +1,131 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <Arduino.h>
+#include "AudioOutputDucker.h"
+
+static const int32_t kUNITY_Q15 = 32768;
+
+AudioOutputDucker::AudioOutputDucker(AudioOutput *sink)
+{
+  this->sink = sink;
+  rate = 22050;
+  keyed = false;
+  SetDuck(1.0f, 0, 0);
+  Reset();
+}
+
+AudioOutputDucker::~AudioOutputDucker() {}
+
+void AudioOutputDucker::Reset()
+{
+  // music started under a word comes in already ducked
+  envelope = keyed ? depth : kUNITY_Q15;
+  gain = envelope;
+  delta = 0;
+  blockPos = 0;
+  isPending = false;
+}
+
+void AudioOutputDucker::SetDuck(float depth, int attackMs, int releaseMs)
+{
+  if (depth < 0.0) depth = 0.0;
+  if (depth > 1.0) depth = 1.0;
+  this->depth = (int32_t)(depth * kUNITY_Q15);
+  this->attackMs = attackMs;
+  this->releaseMs = releaseMs;
+  UpdateSteps();
+}
+
+// the whole swing between unity and the depth in ms, a time of 0 jumps in one block
+void AudioOutputDucker::UpdateSteps()
+{
+  int32_t swing = kUNITY_Q15 - depth;
+  int32_t attack = (int32_t)((int64_t)attackMs * rate / (1000 * kBLOCK));
+  int32_t release = (int32_t)((int64_t)releaseMs * rate / (1000 * kBLOCK));
+
+  attackStep = (attack > 0) ? max(swing / attack, (int32_t)1) : kUNITY_Q15;
+  releaseStep = (release > 0) ? max(swing / release, (int32_t)1) : kUNITY_Q15;
+}
+
+bool AudioOutputDucker::SetRate(int hz)
+{
+  rate = hz;
+  UpdateSteps();
+  return sink->SetRate(hz);
+}
+
+bool AudioOutputDucker::SetBitsPerSample(int bits)
+{
+  return sink->SetBitsPerSample(bits);
+}
+
+bool AudioOutputDucker::SetChannels(int channels)
+{
+  return sink->SetChannels(channels);
+}
+
+bool AudioOutputDucker::SetGain(float gain)
+{
+  return sink->SetGain(gain);
+}
+
+bool AudioOutputDucker::begin()
+{
+  Reset();
+  return sink->begin();
+}
+
+void AudioOutputDucker::NextBlock()
+{
+  int32_t target = keyed ? depth : kUNITY_Q15;
+
+  gain = envelope;
+  if (envelope > target)
+    envelope = max(envelope - attackStep, target);
+  else
+    envelope = min(envelope + releaseStep, target);
+  delta = (envelope - gain) / kBLOCK;
+}
+
+bool AudioOutputDucker::ConsumeSample(int16_t sample[2])
+{
+  // the sink refused the last frame, hold the input back until it goes through
+  if (isPending) {
+    if (!sink->ConsumeSample(pending)) return false;
+    isPending = false;
+  }
+
+  if (blockPos == 0)
+    NextBlock();
+  if (++blockPos == kBLOCK)
+    blockPos = 0;
+
+  if (gain == kUNITY_Q15 && delta == 0) {
+    pending[LEFTCHANNEL] = sample[LEFTCHANNEL];
+    pending[RIGHTCHANNEL] = sample[RIGHTCHANNEL];
+  } else {
+    pending[LEFTCHANNEL] = (int16_t)((sample[LEFTCHANNEL] * gain) >> 15);
+    pending[RIGHTCHANNEL] = (int16_t)((sample[RIGHTCHANNEL] * gain) >> 15);
+    gain += delta;
+  }
+
+  isPending = !sink->ConsumeSample(pending);
+  return true;
+}
+
+bool AudioOutputDucker::stop()
+{
+  Reset();
+  return sink->stop();
+}
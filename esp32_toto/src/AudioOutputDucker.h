@@ -0,0 +1,63 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "AudioOutput.h"
+
+/*
+ Sidechain ducker placed between the music generator and its mixer input.
+ While the sidechain is keyed (a word voice is playing) the Q15 gain ramps down to the
+ duck depth within the attack time, and back to unity within the release time once it
+ is let go. The envelope moves once per kBLOCK frames and the gain is interpolated
+ across the block. The gain of the input itself and the master gain are not touched.
+*/
+class AudioOutputDucker : public AudioOutput
+{
+  public:
+    enum : int { kBLOCK = 32 };         // frames, ~1.5ms at 22050Hz
+
+    AudioOutputDucker(AudioOutput *sink);
+    virtual ~AudioOutputDucker() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int chan) override;
+    virtual bool SetGain(float f) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual bool stop() override;
+
+    void     SetDuck(float depth, int attackMs, int releaseMs);   // depth 1.0 : off
+    void     SetSidechain(bool keyed) { this->keyed = keyed; }
+    uint16_t GetGain() { return envelope; }                        // Q15, 32768 = none
+
+  protected:
+    void Reset();
+    void UpdateSteps();
+    void NextBlock();
+
+    AudioOutput *sink;
+    int      rate;
+    int      attackMs;
+    int      releaseMs;
+    int32_t  depth;                      // Q15
+    int32_t  attackStep;                 // Q15 per block
+    int32_t  releaseStep;
+    bool     keyed;
+    int32_t  envelope;                   // gain at the end of the block, Q15
+    int32_t  gain;                       // gain of the next frame
+    int32_t  delta;                      // per frame
+    int      blockPos;
+    int16_t  pending[2];
+    bool     isPending;
+};
@@ -0,0 +1,150 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <Arduino.h>
+#include "AudioOutputLimiter.h"
+
+static const int32_t kUNITY_Q15     = 32768;
+static const int     kATTACK_SHIFT  = 2;    // 1/4 per frame, settles well inside the lookahead
+static const int     kRELEASE_SHIFT = 11;   // ~90ms time constant at 22050Hz
+
+AudioOutputLimiter::AudioOutputLimiter(AudioOutput *sink)
+{
+  this->sink = sink;
+  threshold = 32112;    // -0.2 dBFS
+  gainQ12 = 1 << 12;
+  Reset();
+}
+
+AudioOutputLimiter::~AudioOutputLimiter() {}
+
+void AudioOutputLimiter::Reset()
+{
+  memset(delayLine, 0, sizeof(delayLine));
+  delayPos = 0;
+  holdMin = kUNITY_Q15;
+  holdCnt = 0;
+  envelope = kUNITY_Q15;
+  isPending = false;
+}
+
+bool AudioOutputLimiter::SetRate(int hz)
+{
+  return sink->SetRate(hz);
+}
+
+bool AudioOutputLimiter::SetBitsPerSample(int bits)
+{
+  return sink->SetBitsPerSample(bits);
+}
+
+bool AudioOutputLimiter::SetChannels(int channels)
+{
+  return sink->SetChannels(channels);
+}
+
+bool AudioOutputLimiter::SetGain(float gain)
+{
+  if (gain < 0.0) gain = 0.0;
+  if (gain > 7.9) gain = 7.9;
+  gainQ12 = (int32_t)(gain * (1 << 12));
+  return true;
+}
+
+bool AudioOutputLimiter::begin()
+{
+  Reset();
+  return sink->begin();
+}
+
+bool AudioOutputLimiter::ConsumeSample(int16_t sample[2])
+{
+  // the sink refused the last frame, hold the input back until it goes through
+  if (isPending) {
+    if (!sink->ConsumeSample(pending)) return false;
+    isPending = false;
+  }
+
+  int32_t l = (sample[LEFTCHANNEL] * gainQ12) >> 12;
+  int32_t r = (sample[RIGHTCHANNEL] * gainQ12) >> 12;
+  int32_t a = (abs(l) > abs(r)) ? abs(l) : abs(r);
+
+  // target gain for this frame, the only division is on frames above the threshold
+  int32_t target = (a > threshold) ? (int32_t)(((int64_t)threshold << 15) / a) : kUNITY_Q15;
+  if (target <= holdMin) {
+    holdMin = target;
+    holdCnt = kLOOKAHEAD;
+  } else if (--holdCnt <= 0) {
+    holdMin = target;
+  }
+
+  if (holdMin < envelope)
+    envelope -= (envelope - holdMin + (1 << kATTACK_SHIFT) - 1) >> kATTACK_SHIFT;
+  else
+    envelope += (holdMin - envelope) >> kRELEASE_SHIFT;
+
+  // swap the new frame into the delay line and gain the oldest one
+  int32_t dl = delayLine[delayPos][LEFTCHANNEL];
+  int32_t dr = delayLine[delayPos][RIGHTCHANNEL];
+  delayLine[delayPos][LEFTCHANNEL] = l;
+  delayLine[delayPos][RIGHTCHANNEL] = r;
+  if (++delayPos == kLOOKAHEAD) delayPos = 0;
+
+  dl = ((int64_t)dl * envelope) >> 15;
+  dr = ((int64_t)dr * envelope) >> 15;
+  pending[LEFTCHANNEL] = (int16_t)constrain(dl, -32767, 32767);
+  pending[RIGHTCHANNEL] = (int16_t)constrain(dr, -32767, 32767);
+
+  isPending = !sink->ConsumeSample(pending);
+  return true;
+}
+
+bool AudioOutputLimiter::stop()
+{
+  Reset();
+  return sink->stop();
+}
+
+// swallows every frame, the bench measures the limiter alone
+class AudioOutputNull : public AudioOutput
+{
+  public:
+    virtual bool begin() override { return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override { (void)sample; return true; }
+    virtual bool stop() override { return true; }
+};
+
+uint32_t AudioOutputLimiter::Bench(float gain, uint32_t frames)
+{
+  static const int kSWEEP = 256;
+  AudioOutputNull null;
+  AudioOutputLimiter limiter(&null);
+  int16_t sweep[kSWEEP][2];
+  float phase = 0.0;
+  uint32_t cycles;
+
+  // 100Hz to ~5kHz over the table at 22050Hz, made before the clock starts
+  for (int i = 0; i < kSWEEP; i++) {
+    phase += 2.0 * PI * (100.0 + i * 20.0) / 22050.0;
+    sweep[i][LEFTCHANNEL] = sweep[i][RIGHTCHANNEL] = (int16_t)(29205 * sinf(phase));
+  }
+
+  limiter.SetGain(gain);
+  limiter.begin();
+  cycles = ESP.getCycleCount();
+  for (uint32_t i = 0; i < frames; i++)
+    limiter.ConsumeSample(sweep[i % kSWEEP]);
+  cycles = ESP.getCycleCount() - cycles;
+  limiter.stop();
+  return frames ? cycles / frames : 0;
+}
@@ -0,0 +1,60 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "AudioOutput.h"
+
+/*
+ Lookahead peak limiter placed between the mixer and the I2S output.
+ It owns the master gain, so boosting above unity no longer hard clips in Amplify().
+ Samples are delayed by kLOOKAHEAD frames while the Q15 gain envelope ramps down in
+ front of a peak, then recovers with a slow release.
+*/
+class AudioOutputLimiter : public AudioOutput
+{
+  public:
+    enum : int { kLOOKAHEAD = 32 };     // frames, ~1.5ms at 22050Hz
+
+    AudioOutputLimiter(AudioOutput *sink);
+    virtual ~AudioOutputLimiter() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int chan) override;
+    virtual bool SetGain(float f) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual bool stop() override;
+
+    void     SetThreshold(int16_t level) { threshold = level; }
+    uint16_t GetReduction() { return envelope; }      // current gain in Q15, 32768 = none
+
+    // CPU cycles per ConsumeSample() over frames of a -1dBFS sine sweep into a sink that
+    // takes everything. A gain above 1.0 pushes it over the threshold and keeps the gain
+    // computation busy
+    static uint32_t Bench(float gain, uint32_t frames);
+
+  protected:
+    void Reset();
+
+    AudioOutput *sink;
+    int32_t  gainQ12;                    // master gain, fixed point 4.12
+    int32_t  threshold;
+    int32_t  delayLine[kLOOKAHEAD][2];
+    int      delayPos;
+    int32_t  holdMin;                    // smallest target gain seen in the lookahead window
+    int      holdCnt;
+    int32_t  envelope;                   // applied gain, Q15
+    int16_t  pending[2];
+    bool     isPending;
+};
@@ -0,0 +1,231 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "ClipCache.h"
+#include "MemAlloc.h"
+#include "Metrics.h"
+#include "RiffParser.h"
+#include "Trace.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const int kTASK_STACK = 4096;
+static const int kTASK_PRIO  = 1;           // below the Arduino loop
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+ClipCache::ClipCache(fs::FS &fs, int prefetch_ms) : _fs(fs) {
+    _prefetch_ms = prefetch_ms;
+    _task        = NULL;
+    _suspended   = false;
+    _suspend_ack = 0;
+    _hits        = 0;
+    _misses      = 0;
+    _open_files  = 0;
+    for (int i = 0; i < kMAX_ENTRIES; i++) {
+        _entries[i].path[0] = 0;
+        _entries[i].buf     = NULL;
+        _entries[i].cap     = 0;
+        _entries[i].state   = CACHE_EMPTY;
+    }
+}
+
+bool ClipCache::begin(int core) {
+    if (_task)
+        return true;
+    return xTaskCreatePinnedToCore(task, "prefetch", kTASK_STACK, this, kTASK_PRIO, &_task, core) == pdPASS;
+}
+
+void ClipCache::notify() {
+    if (_task)
+        xTaskNotifyGive(_task);
+}
+
+cache_entry_t *ClipCache::find(const char *path) {
+    for (int i = 0; i < kMAX_ENTRIES; i++) {
+        if (_entries[i].state != CACHE_EMPTY && !strcmp(_entries[i].path, path))
+            return &_entries[i];
+    }
+    return NULL;
+}
+
+// audio loop : make sure path gets cached, the least recently used idle entry makes room
+void ClipCache::request(const char *path) {
+    cache_entry_t *entry = find(path);
+
+    if (entry) {
+        entry->used = millis();
+        return;
+    }
+
+    for (int i = 0; i < kMAX_ENTRIES; i++) {
+        cache_entry_t *e = &_entries[i];
+
+        if (e->state == CACHE_EMPTY) {
+            entry = e;
+            break;
+        }
+        if ((e->state == CACHE_READY || e->state == CACHE_PARKED) && (!entry || e->used < entry->used))
+            entry = e;
+    }
+    if (!entry)
+        return;
+
+    strncpy(entry->path, path, sizeof(entry->path) - 1);
+    entry->path[sizeof(entry->path) - 1] = 0;
+    entry->used  = millis();
+    entry->state = _suspended ? CACHE_PARKED : CACHE_PENDING;
+    notify();
+}
+
+// audio loop : hand a ready entry to a voice, a miss queues it for the next time
+cache_entry_t *ClipCache::take(const char *path) {
+    cache_entry_t *entry = find(path);
+
+    if (entry && entry->state == CACHE_READY) {
+        entry->used  = millis();
+        entry->state = CACHE_BUSY;
+        _hits++;
+        TRACE(TR_CACHE_HIT, _hits, 0);
+        METRIC_INC(MC_CACHE_HIT);
+        return entry;
+    }
+
+    _misses++;
+    TRACE(TR_CACHE_MISS, _misses, 0);
+    METRIC_INC(MC_CACHE_MISS);
+    if (!entry)
+        request(path);
+    return NULL;
+}
+
+void ClipCache::release(cache_entry_t *entry) {
+    entry->state = CACHE_REWIND;
+    notify();
+}
+
+// close every idle file, for the recorder writing to the card and for deep sleep.
+// voices have to be stopped before, their entries are refilled on resume()
+void ClipCache::suspend() {
+    uint8_t ack = _suspend_ack;
+
+    _suspended = true;
+    if (!_task)
+        return;
+    notify();
+    while (ack == _suspend_ack)
+        delay(1);
+}
+
+void ClipCache::resume() {
+    _suspended = false;
+    for (int i = 0; i < kMAX_ENTRIES; i++) {
+        if (_entries[i].state == CACHE_PARKED)
+            _entries[i].state = CACHE_PENDING;
+    }
+    notify();
+}
+
+// prefetch task : the File objects are never looked at from the audio loop, it reads the
+// count of open ones instead
+bool ClipCache::open_file(cache_entry_t *entry) {
+    close_file(entry);
+    entry->file = _fs.open(entry->path);
+    if (!entry->file)
+        return false;
+    __atomic_fetch_add(&_open_files, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void ClipCache::close_file(cache_entry_t *entry) {
+    if (!entry->file)
+        return;
+    entry->file.close();
+    __atomic_fetch_sub(&_open_files, 1, __ATOMIC_RELAXED);
+}
+
+// prefetch task : the first prefetch ms of samples, wherever the header puts them
+void ClipCache::fill(cache_entry_t *entry) {
+    wav_info_t info;
+    uint32_t   need;
+    uint32_t   ts = micros();
+
+    if (!open_file(entry))
+        goto fail;
+
+    entry->size = entry->file.size();
+    if (!riff_parse(entry->file, &info))
+        goto fail;
+
+    need = (uint64_t)info.rate * info.align * _prefetch_ms / 1000;
+    need = min(need, info.data_len);
+    if (need == 0)
+        goto fail;
+    if (entry->cap < need) {
+        mem_free(entry->buf);
+        entry->buf = (uint8_t *)mem_alloc(need, MEM_LARGE, "cache");
+        entry->cap = entry->buf ? need : 0;
+        if (!entry->buf)
+            goto fail;
+    }
+
+    entry->file.seek(info.data_ofs);
+    entry->ofs = info.data_ofs;
+    entry->len = entry->file.read(entry->buf, need);
+    entry->state = CACHE_READY;
+    TRACE(TR_CACHE_FILL, entry - _entries, micros() - ts);
+    METRIC_ADD(MH_CACHE_FILL_US, micros() - ts);
+    return;
+
+fail:
+    LOG("prefetch failed %s\n", entry->path);
+    close_file(entry);
+    entry->state = CACHE_EMPTY;
+}
+
+void ClipCache::task(void *arg) {
+    ClipCache *cache = (ClipCache *)arg;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // only a pass that started suspended acknowledges it
+        bool suspended = cache->_suspended;
+        for (int i = 0; i < kMAX_ENTRIES; i++) {
+            cache_entry_t *e = &cache->_entries[i];
+
+            if (suspended) {
+                if (e->state != CACHE_EMPTY && e->state != CACHE_BUSY) {
+                    cache->close_file(e);
+                    e->state = CACHE_PARKED;
+                }
+            } else if (e->state == CACHE_PENDING) {
+                cache->fill(e);
+            } else if (e->state == CACHE_REWIND) {
+                // replaying the same key only costs a seek
+                if (e->file && e->file.seek(e->ofs + e->len))
+                    e->state = CACHE_READY;
+                else
+                    cache->fill(e);
+            }
+        }
+        if (suspended)
+            cache->_suspend_ack++;
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CLIP_CACHE_H_
+#define _CLIP_CACHE_H_
+#include <Arduino.h>
+#include "FS.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+// entry ownership : PENDING/REWIND belong to the prefetch task, BUSY to the player,
+// READY/PARKED/EMPTY are idle and only ever changed by the audio loop
+enum : uint8_t {
+    CACHE_EMPTY = 0,
+    CACHE_PENDING,          // task : open, walk the header and read the first blocks
+    CACHE_READY,            // file open and positioned right after the cached bytes
+    CACHE_BUSY,             // a voice is playing it
+    CACHE_REWIND,           // task : seek back behind the cached bytes
+    CACHE_PARKED,           // closed while suspended, refilled on resume()
+};
+
+typedef struct _cache_entry {
+    char             path[64];
+    uint8_t         *buf;               // first prefetch ms of PCM, the header is not kept
+    uint32_t         cap;
+    uint32_t         ofs;               // file offset of buf[0]
+    uint32_t         len;
+    uint32_t         size;              // whole file
+    uint32_t         used;              // millis() of the last request, LRU eviction
+    File             file;
+    volatile uint8_t state;
+} cache_entry_t;
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// keeps the head of the most recently used clips in RAM with their files open, filled by
+// a task on the other core so the audio loop never waits for an open or a header walk
+class ClipCache {
+public:
+    enum : int { kMAX_ENTRIES = 6 };
+
+    ClipCache(fs::FS &fs, int prefetch_ms);
+
+    bool           begin(int core = 0);
+    void           request(const char *path);
+    cache_entry_t *take(const char *path);
+    void           release(cache_entry_t *entry);
+    void           suspend();
+    void           resume();
+    uint32_t       get_hits()           { return _hits; }
+    uint32_t       get_misses()         { return _misses; }
+    int            get_open_count()     { return __atomic_load_n(&_open_files, __ATOMIC_RELAXED); }
+
+private:
+    static void    task(void *arg);
+    void           fill(cache_entry_t *entry);
+    bool           open_file(cache_entry_t *entry);
+    void           close_file(cache_entry_t *entry);
+    cache_entry_t *find(const char *path);
+    void           notify();
+
+    fs::FS          &_fs;
+    int              _prefetch_ms;
+    cache_entry_t    _entries[kMAX_ENTRIES];
+    TaskHandle_t     _task;
+    volatile bool    _suspended;
+    volatile uint8_t _suspend_ack;
+    uint32_t         _hits;
+    uint32_t         _misses;
+    int              _open_files;       // only the task opens and closes entry files
+};
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "ClipLibrary.h"
+#include "MemAlloc.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const uint16_t kTARGET_RMS = 3277;       // -20 dBFS
+static const uint16_t kPEAK_LIMIT = 32112;      // -0.2 dBFS
+static const int      kREAD_SIZE  = 4096;
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+static uint32_t isqrt(uint64_t v) {
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > v)
+        bit >>= 2;
+
+    while (bit) {
+        if (v >= res + bit) {
+            v  -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+static int compare_clip(const void *a, const void *b) {
+    return strcmp(((clip_info_t *)a)->name, ((clip_info_t *)b)->name);
+}
+
+ClipLibrary::ClipLibrary(fs::FS &fs, const char *dir, const char *index) : _fs(fs) {
+    _dir   = dir;
+    _index = index;
+    _count = 0;
+}
+
+/*
+*****************************************************************************************
+* index file
+*****************************************************************************************
+*/
+bool ClipLibrary::load_index(clip_info_t *cache, int *cache_cnt) {
+    clip_index_header_t hdr;
+    File file = _fs.open(_index, FILE_READ);
+
+    *cache_cnt = 0;
+    if (!file)
+        return false;
+
+    if (file.read((uint8_t *)&hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != CLIP_INDEX_MAGIC || hdr.version != CLIP_INDEX_VERSION) {
+        LOG("index %s is stale, rebuilding\n", _index);
+        file.close();
+        return false;
+    }
+
+    int cnt = min((int)hdr.count, (int)kMAX_CLIPS);
+    *cache_cnt = file.read((uint8_t *)cache, sizeof(clip_info_t) * cnt) / sizeof(clip_info_t);
+    file.close();
+
+    return true;
+}
+
+bool ClipLibrary::save_index() {
+    clip_index_header_t hdr;
+    File file = _fs.open(_index, FILE_WRITE);
+
+    if (!file) {
+        LOG("index %s write failed\n", _index);
+        return false;
+    }
+
+    hdr.magic   = CLIP_INDEX_MAGIC;
+    hdr.version = CLIP_INDEX_VERSION;
+    hdr.count   = _count;
+    file.write((uint8_t *)&hdr, sizeof(hdr));
+    file.write((uint8_t *)_clips, sizeof(clip_info_t) * _count);
+    file.close();
+
+    return true;
+}
+
+/*
+*****************************************************************************************
+* loudness analysis
+*****************************************************************************************
+*/
+// the header is walked here once, where the PCM is and its format are kept in the index
+bool ClipLibrary::analyse(File &file, clip_info_t *clip) {
+    wav_info_t info;
+
+    clip->peak     = 0;
+    clip->rms      = 0;
+    clip->gain     = CLIP_GAIN_UNITY;
+    clip->data_ofs = 0;
+
+    if (!riff_parse(file, &info) || info.format != WAVE_FORMAT_PCM || info.bits != 16 || !file.seek(info.data_ofs))
+        return false;
+
+    int16_t *buf = (int16_t *)mem_alloc(kREAD_SIZE, MEM_LARGE, "analyse");
+    if (!buf)
+        return false;
+
+    uint64_t pwr   = 0;
+    uint32_t cnt   = 0;
+    uint16_t peak  = 0;
+    uint32_t left  = info.data_len;
+
+    while (left > 0) {
+        int len = file.read((uint8_t *)buf, min(left, (uint32_t)kREAD_SIZE));
+        if (len <= 0)
+            break;
+
+        int n = len / sizeof(int16_t);
+        for (int i = 0; i < n; i++) {
+            int32_t  s = buf[i];
+            uint16_t a = (s < 0) ? -s : s;
+
+            pwr += (uint32_t)(s * s);
+            if (a > peak)
+                peak = a;
+        }
+        cnt  += n;
+        left -= len;
+    }
+    mem_free(buf);
+
+    if (cnt == 0 || peak == 0)
+        return false;
+
+    // gain to reach the target loudness, capped so the peak does not clip
+    uint32_t rms  = isqrt(pwr / cnt);
+    uint32_t gain = ((uint32_t)kTARGET_RMS << 6) / max(rms, (uint32_t)1);
+    uint32_t cap  = ((uint32_t)kPEAK_LIMIT << 6) / peak;
+
+    gain = min(gain, cap);
+    gain = constrain(gain, (uint32_t)1, (uint32_t)255);
+
+    clip->peak       = peak;
+    clip->rms        = rms;
+    clip->gain       = gain;
+    clip->data_ofs   = info.data_ofs;
+    clip->data_len   = info.data_len;
+    clip->rate       = info.rate;
+    clip->channels   = info.channels;
+    clip->loop_start = info.loop_start;
+    clip->loop_end   = info.loop_end;
+
+    return true;
+}
+
+/*
+*****************************************************************************************
+* directory scan
+*****************************************************************************************
+*/
+int ClipLibrary::scan() {
+    int          cache_cnt = 0;
+    int          analysed  = 0;
+    clip_info_t *cache     = (clip_info_t *)mem_alloc(sizeof(clip_info_t) * kMAX_CLIPS, MEM_LARGE, "index");
+
+    if (cache)
+        load_index(cache, &cache_cnt);
+
+    _count = 0;
+    File root = _fs.open(_dir);
+    if (!root || !root.isDirectory()) {
+        LOG("Failed to open directory %s\n", _dir);
+        mem_free(cache);
+        return 0;
+    }
+
+    File file = root.openNextFile();
+    while (file && _count < kMAX_CLIPS) {
+        const char *name = file.name();
+        int         len  = strlen(name);
+
+        if (!file.isDirectory() && len > 4 && len < CLIP_NAME_LEN && !strcasecmp(name + len - 4, ".wav")) {
+            clip_info_t *clip = &_clips[_count];
+            clip_info_t *hit  = NULL;
+
+            memset(clip, 0, sizeof(clip_info_t));
+            strcpy(clip->name, name);
+            clip->size  = file.size();
+            clip->mtime = file.getLastWrite();
+
+            for (int i = 0; i < cache_cnt; i++) {
+                if (!strcmp(cache[i].name, clip->name) && cache[i].size == clip->size && cache[i].mtime == clip->mtime) {
+                    hit = &cache[i];
+                    break;
+                }
+            }
+
+            if (hit) {
+                *clip = *hit;
+            } else {
+                analyse(file, clip);
+                analysed++;
+            }
+            LOG(" %-30s  %8lu peak:%5d rms:%5d gain:%4.2f\n", clip->name, (unsigned long)clip->size, clip->peak, clip->rms,
+                clip->gain / (float)CLIP_GAIN_UNITY);
+            _count++;
+        }
+        file = root.openNextFile();
+    }
+    root.close();
+
+    qsort(_clips, _count, sizeof(clip_info_t), compare_clip);
+    if (analysed > 0 || _count != cache_cnt)
+        save_index();
+    LOG("library %s : %d clips, %d analysed\n", _dir, _count, analysed);
+    mem_free(cache);
+
+    return _count;
+}
+
+// swaps a received file in for name : the old clip is only removed once the new one is
+// in place, and only its index entry is analysed again
+bool ClipLibrary::install(const char *tmp_path, const char *name) {
+    String path = String(_dir) + "/" + name;
+    String bak  = path + ".bak";
+    bool   had  = _fs.exists(path.c_str());
+
+    if (had && !_fs.rename(path.c_str(), bak.c_str()))
+        return false;
+    if (!_fs.rename(tmp_path, path.c_str())) {
+        if (had)
+            _fs.rename(bak.c_str(), path.c_str());
+        return false;
+    }
+    if (had)
+        _fs.remove(bak.c_str());
+
+    // a new entry is only counted once there is a file to fill it from
+    File file = _fs.open(path.c_str());
+    if (!file)
+        return false;
+
+    clip_info_t *clip = NULL;
+    for (int i = 0; i < _count; i++) {
+        if (!strcmp(_clips[i].name, name)) {
+            clip = &_clips[i];
+            break;
+        }
+    }
+    if (!clip) {
+        if (_count >= kMAX_CLIPS) {
+            file.close();
+            return false;
+        }
+        clip = &_clips[_count++];
+    }
+
+    memset(clip, 0, sizeof(clip_info_t));
+    strcpy(clip->name, name);
+    clip->size  = file.size();
+    clip->mtime = file.getLastWrite();
+    analyse(file, clip);
+    file.close();
+    LOG(" %-30s  %8lu peak:%5d rms:%5d gain:%4.2f\n", clip->name, (unsigned long)clip->size, clip->peak, clip->rms,
+        clip->gain / (float)CLIP_GAIN_UNITY);
+
+    qsort(_clips, _count, sizeof(clip_info_t), compare_clip);
+    return save_index();
+}
+
+/*
+*****************************************************************************************
+* lookup
+*****************************************************************************************
+*/
+// stable over rescans and re-recordings, the session log refers to clips by it
+uint16_t ClipLibrary::get_id(clip_info_t *clip) {
+    uint32_t h = 2166136261UL;
+
+    for (const char *p = clip->name; *p; p++)
+        h = (h ^ (uint8_t)*p) * 16777619UL;
+    return (h >> 16) ^ (h & 0xffff);
+}
+
+// false for a clip the analysis could not parse, its file has to be walked on open
+bool ClipLibrary::get_wav_info(clip_info_t *clip, wav_info_t *info) {
+    if (!clip->data_ofs)
+        return false;
+
+    info->format     = WAVE_FORMAT_PCM;
+    info->channels   = clip->channels;
+    info->rate       = clip->rate;
+    info->bits       = 16;
+    info->align      = clip->channels * 2;
+    info->data_ofs   = clip->data_ofs;
+    info->data_len   = clip->data_len;
+    info->loop_start = clip->loop_start;
+    info->loop_end   = clip->loop_end;
+    return true;
+}
+
+clip_info_t *ClipLibrary::find_by_id(uint16_t id) {
+    for (int i = 0; i < _count; i++) {
+        if (get_id(&_clips[i]) == id)
+            return &_clips[i];
+    }
+    return NULL;
+}
+
+clip_info_t *ClipLibrary::find_by_number(int number) {
+    char buf[12];
+
+    sprintf(buf, "%02d_", number);
+    for (int i = 0; i < _count; i++) {
+        if (!strncmp(_clips[i].name, buf, strlen(buf)))
+            return &_clips[i];
+    }
+    return NULL;
+}
+
+String ClipLibrary::get_path(clip_info_t *clip) {
+    return String(_dir) + "/" + String(clip->name);
+}
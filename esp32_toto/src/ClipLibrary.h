@@ -0,0 +1,92 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CLIP_LIBRARY_H_
+#define _CLIP_LIBRARY_H_
+#include <Arduino.h>
+#include "FS.h"
+#include "RiffParser.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+#define CLIP_INDEX_MAGIC        0x58444954      // "TIDX"
+#define CLIP_INDEX_VERSION      3
+#define CLIP_NAME_LEN           48
+#define CLIP_GAIN_UNITY         (1 << 6)        // AudioOutput gain is fixed point 2.6
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+#pragma pack(push, 1)
+typedef struct _clip_index_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} clip_index_header_t;
+
+typedef struct _clip_info {
+    char     name[CLIP_NAME_LEN];   // file name inside the library directory
+    uint32_t size;                  // size and mtime tell if the cached entry is stale
+    uint32_t mtime;
+    uint16_t peak;                  // absolute peak over all samples
+    uint16_t rms;
+    uint8_t  gain;                  // loudness normalisation gain, 2.6 fixed point
+    uint32_t data_ofs;              // PCM in the file, 0 when the clip could not be parsed
+    uint32_t data_len;
+    uint32_t rate;
+    uint8_t  channels;              // always 16 bit
+    uint32_t loop_start;            // sustain loop in frames, end excluded, 0 and 0 for none
+    uint32_t loop_end;
+} clip_info_t;
+#pragma pack(pop)
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+class ClipLibrary {
+public:
+    enum : int { kMAX_CLIPS = 64 };
+
+    ClipLibrary(fs::FS &fs, const char *dir, const char *index);
+
+    int          scan();
+    bool         install(const char *tmp_path, const char *name);
+    int          get_count()        { return _count; }
+    clip_info_t *get(int idx)       { return (idx >= 0 && idx < _count) ? &_clips[idx] : NULL; }
+    clip_info_t *find_by_number(int number);
+    clip_info_t *find_by_id(uint16_t id);
+    static uint16_t get_id(clip_info_t *clip);
+    static bool  get_wav_info(clip_info_t *clip, wav_info_t *info);
+    String       get_path(clip_info_t *clip);
+
+private:
+    bool         load_index(clip_info_t *cache, int *cache_cnt);
+    bool         save_index();
+    bool         analyse(File &file, clip_info_t *clip);
+
+    fs::FS      &_fs;
+    const char  *_dir;
+    const char  *_index;
+    clip_info_t  _clips[kMAX_CLIPS];
+    int          _count;
+};
+
+#endif
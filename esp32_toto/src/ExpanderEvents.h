@@ -0,0 +1,107 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EXPANDER_EVENTS_H_
+#define _EXPANDER_EVENTS_H_
+#include <stdint.h>
+
+/*
+ The expander side of GpioExpander that does not touch I2C : register map, event
+ decoding and key numbering. Plain C++ only, arduino_gpio_exander/test/test_expander_events
+ runs it on a host against a simulated expander.
+*/
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// register map, keep in sync with arduino_gpio_exander/src/config.h
+enum {
+    EXP_REG_NOP = 0x00,
+    EXP_REG_SET_POWER_DOWN,
+    EXP_REG_GET_PIN_STATUS,
+    EXP_REG_GET_EVENT_COUNT,
+    EXP_REG_GET_EVENTS,
+    EXP_REG_GET_OVERFLOW,
+    EXP_REG_SET_DEBOUNCE,
+    EXP_REG_GET_DEBOUNCE,
+    EXP_REG_SET_ADDR,
+    EXP_REG_SET_SCAN_MODE,
+    EXP_REG_SET_SCAN_RATE,
+    EXP_REG_GET_SCAN_RATE,
+    EXP_REG_GET_KEY_COUNT,
+    EXP_REG_GET_MATRIX_STATUS,
+    EXP_REG_GET_GHOST_COUNT,
+    EXP_REG_GET_WAKE_KEY,
+};
+
+#define EXP_EVENT_BURST_MAX     10
+#define EXP_EVENT_LEN           3       // code, ts (u16 little endian)
+#define EXP_EVENT_PIN_MASK      0x3F
+#define EXP_EVENT_EDGE_HIGH     0x80
+#define EXP_WAKE_KEY_NONE       0xFF
+#define EXP_KEYS_PER_DEVICE     16      // when the device does not report its key count
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+typedef struct _key_event {
+    uint8_t     key;            // keys of the lower addressed devices + expander key number
+    bool        down;
+    uint16_t    ts;             // expander millis() & 0xffff
+} key_event_t;
+
+/*
+*****************************************************************************************
+* FUNCTIONS
+*****************************************************************************************
+*/
+// first key of the next device, it starts after the last key of this one
+static inline uint8_t exp_next_key_base(uint8_t key_base, int keys) {
+    return key_base + ((keys > 0) ? keys : EXP_KEYS_PER_DEVICE);
+}
+
+// one event as the expander sends it
+static inline void exp_to_event(uint8_t key_base, bool active_high, const uint8_t *raw, key_event_t *evt) {
+    evt->key  = key_base + (raw[0] & EXP_EVENT_PIN_MASK);
+    evt->down = ((raw[0] & EXP_EVENT_EDGE_HIGH) != 0) == active_high;
+    evt->ts   = raw[1] | (raw[2] << 8);
+}
+
+// bytes of a burst read asking for cnt events : count byte followed by the events
+static inline uint8_t exp_burst_len(uint8_t cnt) {
+    return 1 + cnt * EXP_EVENT_LEN;
+}
+
+// events of a burst asking for cnt, never more than were asked for whatever the count byte says
+static inline uint8_t exp_parse_burst(const uint8_t *burst, uint8_t cnt, uint8_t key_base, bool active_high,
+                                      key_event_t *evts) {
+    if (burst[0] < cnt)
+        cnt = burst[0];
+    for (uint8_t i = 0; i < cnt; i++)
+        exp_to_event(key_base, active_high, burst + 1 + i * EXP_EVENT_LEN, &evts[i]);
+    return cnt;
+}
+
+// false when the device was not woken by one of its keys
+static inline bool exp_parse_wake(const uint8_t *raw, uint8_t key_base, bool active_high, key_event_t *evt) {
+    if (raw[0] == EXP_WAKE_KEY_NONE)
+        return false;
+    exp_to_event(key_base, active_high, raw, evt);
+    return true;
+}
+
+#endif
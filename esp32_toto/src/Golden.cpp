@@ -0,0 +1,215 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "Golden.h"
+#include "GoldenRef.h"
+#include "SessionLog.h"
+#include "SessionRender.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const int kCLIPS      = ARRAY_SIZE(kGOLDEN_CLIPS);
+static const int kMAX_GAP_MS = 1000;        // longer than any step of a script
+
+typedef struct _golden_step {
+    uint16_t    ts;                 // ms from the start of the script
+    uint8_t     type;               // SESSION_KEY or SESSION_GAIN
+    uint8_t     arg;                // clip 0..kCLIPS-1, or gain in 1/10
+} golden_step_t;
+
+typedef struct _golden_scenario {
+    const char          *name;
+    const golden_step_t *steps;
+    uint8_t              cnt;
+} golden_scenario_t;
+
+static const golden_step_t kSINGLE[] = {
+    { 0,   SESSION_KEY, 0 },
+};
+
+static const golden_step_t kOVERLAP[] = {
+    { 0,   SESSION_KEY, 0 },
+    { 100, SESSION_KEY, 1 },
+    { 200, SESSION_KEY, 2 },
+};
+
+// two voices under a master gain from quiet to well into the limiter and back
+static const golden_step_t kGAIN_SWEEP[] = {
+    { 0,   SESSION_GAIN, 2 },
+    { 0,   SESSION_KEY,  0 },
+    { 0,   SESSION_KEY,  1 },
+    { 50,  SESSION_GAIN, 6 },
+    { 100, SESSION_GAIN, 10 },
+    { 150, SESSION_GAIN, 14 },
+    { 200, SESSION_GAIN, 20 },
+    { 300, SESSION_GAIN, 10 },
+    { 400, SESSION_GAIN, 3 },
+};
+
+// every voice busy, each further press cuts the first one short
+static const golden_step_t kSTOLEN[] = {
+    { 0,   SESSION_KEY, 0 },
+    { 50,  SESSION_KEY, 1 },
+    { 100, SESSION_KEY, 2 },
+    { 150, SESSION_KEY, 0 },
+    { 200, SESSION_KEY, 1 },
+    { 250, SESSION_KEY, 2 },
+};
+
+static const golden_scenario_t kSCENARIOS[] = {
+    { "single",     kSINGLE,     ARRAY_SIZE(kSINGLE) },
+    { "overlap",    kOVERLAP,    ARRAY_SIZE(kOVERLAP) },
+    { "gain_sweep", kGAIN_SWEEP, ARRAY_SIZE(kGAIN_SWEEP) },
+    { "stolen",     kSTOLEN,     ARRAY_SIZE(kSTOLEN) },
+};
+
+static const int kSCENARIO_CNT = ARRAY_SIZE(kSCENARIOS);
+
+static_assert(ARRAY_SIZE(kGOLDEN_REFS) == ARRAY_SIZE(kSCENARIOS), "one reference per scenario");
+static_assert(ARRAY_SIZE(kGOLDEN_CLIPS) <= Golden::kMAX_CLIPS, "more clips than Golden holds");
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+Golden::Golden(fs::FS &fs, ClipLibrary &library, float headroom, const char *log_path)
+    : _fs(fs), _library(library) {
+    _headroom = headroom;
+    _log_path = log_path;
+    memset(_clips, 0, sizeof(_clips));
+}
+
+// the clips of wav/ by name, each one has to be the very file of the repository
+bool Golden::find_clips(Print &out) {
+    uint8_t buf[512];
+
+    for (int i = 0; i < kCLIPS; i++) {
+        const golden_clip_t *pin = &kGOLDEN_CLIPS[i];
+        uint32_t             fnv = 2166136261u;
+
+        _clips[i] = NULL;
+        for (int j = 0; j < _library.get_count(); j++) {
+            if (!strcmp(_library.get(j)->name, pin->name))
+                _clips[i] = _library.get(j);
+        }
+        if (!_clips[i]) {
+            out.printf("GOLDEN %s is not in the library, copy it from wav/\n", pin->name);
+            return false;
+        }
+
+        File file = _fs.open(_library.get_path(_clips[i]).c_str());
+        if (!file) {
+            out.printf("GOLDEN can not open %s\n", pin->name);
+            return false;
+        }
+        for (int n; (n = file.read(buf, sizeof(buf))) > 0;) {
+            for (int j = 0; j < n; j++)
+                fnv = (fnv ^ buf[j]) * 16777619u;
+        }
+        uint32_t size = file.size();
+        file.close();
+        if (size != pin->size || fnv != pin->fnv) {
+            out.printf("GOLDEN %s is not the file of wav/ (size %u, fnv %08x)\n", pin->name, (unsigned)size,
+                       (unsigned)fnv);
+            return false;
+        }
+    }
+    return true;
+}
+
+// the script as a session log, the same file format SessionRender reviews sessions from
+bool Golden::write_log(int scenario) {
+    const golden_scenario_t *sc   = &kSCENARIOS[scenario];
+    File                     file = _fs.open(_log_path, FILE_WRITE);
+
+    if (!file)
+        return false;
+    for (int i = 0; i < sc->cnt; i++) {
+        session_event_t evt;
+
+        evt.ts   = sc->steps[i].ts;
+        evt.type = sc->steps[i].type;
+        evt.key  = 0;
+        if (evt.type == SESSION_GAIN)
+            evt.clip = sc->steps[i].arg * 256 / 10;
+        else
+            evt.clip = ClipLibrary::get_id(_clips[sc->steps[i].arg]);
+        file.write((uint8_t *)&evt, sizeof(evt));
+    }
+    file.close();
+    return true;
+}
+
+int Golden::run(Print &out, bool bless) {
+    uint32_t hashes[kSCENARIO_CNT];
+    uint32_t frames[kSCENARIO_CNT];
+    uint32_t total_frames = 0;
+    uint32_t total_ms     = 0;
+    int      failed       = 0;
+
+    if (!find_clips(out))
+        return -1;
+
+    for (int i = 0; i < kSCENARIO_CNT; i++) {
+        const golden_ref_t *ref = &kGOLDEN_REFS[i];
+        SessionRender       render(_library, _headroom, kMAX_GAP_MS);
+        uint32_t            ts;
+        uint32_t            ms;
+        uint32_t            speed;
+        const char         *result;
+
+        if (!write_log(i)) {
+            out.printf("GOLDEN %s : can not write %s\n", kSCENARIOS[i].name, _log_path);
+            return -1;
+        }
+        ts = millis();
+        render.render(_fs, _log_path, NULL);
+        ms = max(millis() - ts, (uint32_t)1);
+
+        hashes[i] = render.get_hash();
+        frames[i] = render.get_frames();
+        if (bless)
+            result = "blessed";
+        else if (ref->frames == 0)
+            result = "FAIL no reference";
+        else if (hashes[i] != ref->hash || frames[i] != ref->frames)
+            result = "FAIL";
+        else
+            result = "ok";
+        if (!bless && strcmp(result, "ok"))
+            failed++;
+        total_frames += frames[i];
+        total_ms     += ms;
+
+        // times real time in 1/100, the whole offline chain : SD reads, decode, mixer, limiter
+        speed = frames[i] * 100000ULL / SessionRender::kRATE / ms;
+        out.printf("GOLDEN %-10s %08x %7u frames %5u ms %3u.%02ux %s\n", kSCENARIOS[i].name, (unsigned)hashes[i],
+                   (unsigned)frames[i], (unsigned)ms, (unsigned)(speed / 100), (unsigned)(speed % 100), result);
+    }
+    _fs.remove(_log_path);
+
+    // nothing is stored on the card, the table goes into GoldenRef.h with the change
+    if (bless) {
+        out.printf("GOLDEN kGOLDEN_REFS for GoldenRef.h :\n");
+        for (int i = 0; i < kSCENARIO_CNT; i++)
+            out.printf("    { \"%s\",%*s 0x%08x, %u },\n", kSCENARIOS[i].name, 10 - (int)strlen(kSCENARIOS[i].name), "",
+                       (unsigned)hashes[i], (unsigned)frames[i]);
+    }
+    out.printf("GOLDEN %d of %d failed, %u frames in %u ms\n", failed, kSCENARIO_CNT, (unsigned)total_frames,
+               (unsigned)total_ms);
+    return failed;
+}
@@ -0,0 +1,51 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _GOLDEN_H_
+#define _GOLDEN_H_
+#include <Arduino.h>
+#include "ClipLibrary.h"
+#include "FS.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// scripted sessions over clips of wav/ rendered through SessionRender, the hash of every
+// output is compared with the reference committed in GoldenRef.h. Any change to the
+// mixer, the gains or the limiter that is not bit exact shows up as a FAIL, and the
+// render speed of each scenario is printed next to it
+class Golden {
+public:
+    enum : int { kMAX_CLIPS = 4 };
+
+    Golden(fs::FS &fs, ClipLibrary &library, float headroom, const char *log_path);
+
+    // returns the number of failed scenarios, -1 when a clip is missing or differs from
+    // wav/. bless prints the reference table of this run instead of comparing
+    int run(Print &out, bool bless);
+
+private:
+    bool find_clips(Print &out);
+    bool write_log(int scenario);
+
+    fs::FS      &_fs;
+    ClipLibrary &_library;
+    float        _headroom;
+    const char  *_log_path;
+    clip_info_t *_clips[kMAX_CLIPS];
+};
+
+#endif
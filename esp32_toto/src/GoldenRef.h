@@ -0,0 +1,57 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _GOLDEN_REF_H_
+#define _GOLDEN_REF_H_
+#include <Arduino.h>
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+typedef struct _golden_clip {
+    const char  *name;              // file of wav/ in the repository, copied to the library
+    uint32_t     size;
+    uint32_t     fnv;               // FNV-1a of the whole file
+} golden_clip_t;
+
+typedef struct _golden_ref {
+    const char  *name;              // scenario
+    uint32_t     hash;              // FNV-1a of the rendered mono samples
+    uint32_t     frames;            // 0 : not blessed yet
+} golden_ref_t;
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// the scripts play these clips and nothing else, a library holding other files under the
+// same names fails before anything is rendered
+static const golden_clip_t kGOLDEN_CLIPS[] = {
+    { "00_아빠.wav",      33002, 0x7c5cb5a0 },
+    { "01_엄마.wav",      32330, 0x975cc301 },
+    { "02_토토는요.wav",  49146, 0xac2a8b7c },
+};
+
+// expected output of every scenario. 'B' on the board prints this table for the current
+// mixer chain, a change of the output is committed here together with the change of code
+static const golden_ref_t kGOLDEN_REFS[] = {
+    { "single",     0xb08bf559, 16511 },
+    { "overlap",    0x7ab2a18e, 28999 },
+    { "gain_sweep", 0x5bd87123, 16511 },
+    { "stolen",     0x48d57d79, 30108 },
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "GpioExpander.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+GpioExpander::GpioExpander(uint8_t base_addr, uint8_t max_devices, int pin_int, bool active_high) {
+    _wire        = NULL;
+    _base_addr   = base_addr;
+    _max_devices = min((int)max_devices, (int)kMAX_DEVICES);
+    _dev_cnt     = 0;
+    _key_base[0] = 0;
+    _pin_int     = pin_int;
+    _active_high = active_high;
+    _irq         = false;
+    _head        = 0;
+    _tail        = 0;
+    _lost        = false;
+}
+
+void IRAM_ATTR GpioExpander::isr(void *arg) {
+    ((GpioExpander *)arg)->_irq = true;
+}
+
+bool GpioExpander::write_reg(uint8_t addr, uint8_t reg, int param) {
+    _wire->beginTransmission(addr);
+    _wire->write(reg);
+    if (param >= 0)
+        _wire->write((uint8_t)param);
+
+    // repeated start, the register is read back in the same transaction
+    return _wire->endTransmission(false) == 0;
+}
+
+bool GpioExpander::begin(TwoWire &wire, uint8_t debounce_ms) {
+    _wire    = &wire;
+    _dev_cnt = 0;
+
+    // devices are numbered in address order, so key numbers follow the address straps.
+    // a device in matrix mode has more keys, the next one starts after its last key
+    for (uint8_t i = 0; i < _max_devices; i++) {
+        uint8_t addr = _base_addr + i;
+
+        _wire->beginTransmission(addr);
+        if (_wire->endTransmission() != 0)
+            continue;
+
+        _wire->beginTransmission(addr);
+        _wire->write(EXP_REG_SET_DEBOUNCE);
+        _wire->write(debounce_ms);
+        _wire->endTransmission();
+
+        _addrs[_dev_cnt] = addr;
+        _key_base[_dev_cnt + 1] = exp_next_key_base(_key_base[_dev_cnt], read_reg8(_dev_cnt, EXP_REG_GET_KEY_COUNT));
+
+        // the snapshot read also drops whatever was queued before we came up
+        LOG("expander %d at 0x%02x keys:%d status:%04x\n", _dev_cnt, addr,
+            _key_base[_dev_cnt + 1] - _key_base[_dev_cnt], get_status(_dev_cnt));
+        _dev_cnt++;
+    }
+
+    if (_dev_cnt == 0) {
+        LOG("no expander found from 0x%02x\n", _base_addr);
+        return false;
+    }
+
+    // the request line is open drain and needs an external pull-up
+    pinMode(_pin_int, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(_pin_int), isr, this, FALLING);
+
+    return true;
+}
+
+uint16_t GpioExpander::get_status(uint8_t dev) {
+    uint16_t d16 = 0;
+
+    if (write_reg(_addrs[dev], EXP_REG_GET_PIN_STATUS) && _wire->requestFrom(_addrs[dev], (uint8_t)2) == 2) {
+        d16  = _wire->read();
+        d16 |= _wire->read() << 8;
+    }
+    return d16;
+}
+
+int GpioExpander::read_reg8(uint8_t dev, uint8_t reg) {
+    if (!write_reg(_addrs[dev], reg) || _wire->requestFrom(_addrs[dev], (uint8_t)1) != 1)
+        return -1;
+    return _wire->read();
+}
+
+int GpioExpander::get_event_count(uint8_t dev) {
+    return read_reg8(dev, EXP_REG_GET_EVENT_COUNT);
+}
+
+// the whole answer of a request, or nothing
+bool GpioExpander::read_bytes(uint8_t dev, uint8_t *buf, uint8_t len) {
+    if (_wire->requestFrom(_addrs[dev], len) != len)
+        return false;
+    for (uint8_t i = 0; i < len; i++)
+        buf[i] = _wire->read();
+    return true;
+}
+
+// one burst, decoded by ExpanderEvents.h
+int GpioExpander::read_events(uint8_t dev, uint8_t cnt) {
+    uint8_t     burst[1 + EXP_EVENT_BURST_MAX * EXP_EVENT_LEN];
+    key_event_t evts[EXP_EVENT_BURST_MAX];
+
+    cnt = min((int)cnt, EXP_EVENT_BURST_MAX);
+    if (!write_reg(_addrs[dev], EXP_REG_GET_EVENTS, cnt) || !read_bytes(dev, burst, exp_burst_len(cnt)))
+        return -1;
+
+    cnt = exp_parse_burst(burst, cnt, _key_base[dev], _active_high, evts);
+    for (uint8_t i = 0; i < cnt; i++) {
+        if ((uint8_t)(_head - _tail) >= kQUEUE_SIZE) {
+            TRACE(TR_EXP_QUEUE_FULL, dev, evts[i].key);
+            METRIC_INC(MC_EXP_QUEUE_FULL);
+            _lost = true;
+            continue;
+        }
+
+        _queue[_head & (kQUEUE_SIZE - 1)] = evts[i];
+        _head++;
+    }
+    return cnt;
+}
+
+// drain the expanders after one of them pulled the request line, nothing is polled
+// over I2C while it is idle. Every device reports its own pending count, only the
+// ones with events get a burst read
+int GpioExpander::service() {
+    int total = 0;
+    int i;
+
+    if (_dev_cnt == 0 || (!_irq && digitalRead(_pin_int) == HIGH))
+        return 0;
+
+    // bounded, so a chattering input can not starve the audio loop
+    _irq = false;
+    for (i = 0; i < 4 && digitalRead(_pin_int) == LOW; i++) {
+        int round = 0;
+
+        for (uint8_t dev = 0; dev < _dev_cnt; dev++) {
+            int cnt = get_event_count(dev);
+
+            if (cnt > 0)
+                round += max(read_events(dev, cnt), 0);
+        }
+        if (round == 0)
+            break;
+        total += round;
+    }
+    TRACE(TR_EXP_SERVICE, total, i);
+    return total;
+}
+
+bool GpioExpander::get_event(key_event_t *evt) {
+    if (_head == _tail)
+        return false;
+
+    *evt = _queue[_tail & (kQUEUE_SIZE - 1)];
+    _tail++;
+    return true;
+}
+
+// true once after events were dropped on a full queue, a key-up may be among them
+bool GpioExpander::take_lost() {
+    bool lost = _lost;
+
+    _lost = false;
+    return lost;
+}
+
+// every device drops what is pending, releases the request line and latches the next key.
+// the caller sleeps on the request line after this
+bool GpioExpander::power_down() {
+    bool ret = true;
+
+    detachInterrupt(digitalPinToInterrupt(_pin_int));
+    for (uint8_t dev = 0; dev < _dev_cnt; dev++) {
+        _wire->beginTransmission(_addrs[dev]);
+        _wire->write(EXP_REG_SET_POWER_DOWN);
+        ret &= (_wire->endTransmission() == 0);
+    }
+    _head = _tail = 0;
+    _irq  = false;
+    return ret && _dev_cnt > 0;
+}
+
+// key that pulled the request line while we were asleep, the lowest addressed device wins
+bool GpioExpander::get_wake_key(key_event_t *evt) {
+    for (uint8_t dev = 0; dev < _dev_cnt; dev++) {
+        uint8_t raw[EXP_EVENT_LEN];
+
+        if (write_reg(_addrs[dev], EXP_REG_GET_WAKE_KEY) && read_bytes(dev, raw, sizeof(raw)) &&
+            exp_parse_wake(raw, _key_base[dev], _active_high, evt))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,69 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _GPIO_EXPANDER_H_
+#define _GPIO_EXPANDER_H_
+#include <Arduino.h>
+#include <Wire.h>
+#include "utils.h"
+#include "ExpanderEvents.h"
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// one or more expanders on consecutive addresses sharing one open drain request line
+class GpioExpander {
+public:
+    enum : int { kQUEUE_SIZE = 32,      // power of 2
+                 kMAX_DEVICES = 4 };
+
+    GpioExpander(uint8_t base_addr, uint8_t max_devices, int pin_int, bool active_high = true);
+
+    bool     begin(TwoWire &wire, uint8_t debounce_ms);
+    bool     is_present()           { return _dev_cnt > 0; }
+    uint8_t  get_device_count()     { return _dev_cnt; }
+    uint8_t  get_key_count()        { return _key_base[_dev_cnt]; }
+    int      service();
+    bool     get_event(key_event_t *evt);
+    bool     take_lost();
+    uint16_t get_status(uint8_t dev);
+    bool     power_down();
+    bool     get_wake_key(key_event_t *evt);
+    int      get_pin_int()          { return _pin_int; }
+
+private:
+    static void IRAM_ATTR isr(void *arg);
+    bool     write_reg(uint8_t addr, uint8_t reg, int param = -1);
+    int      get_event_count(uint8_t dev);
+    int      read_events(uint8_t dev, uint8_t cnt);
+    int      read_reg8(uint8_t dev, uint8_t reg);
+    bool     read_bytes(uint8_t dev, uint8_t *buf, uint8_t len);
+
+    TwoWire         *_wire;
+    uint8_t          _base_addr;
+    uint8_t          _max_devices;
+    uint8_t          _addrs[kMAX_DEVICES];
+    uint8_t          _key_base[kMAX_DEVICES + 1];
+    uint8_t          _dev_cnt;
+    int              _pin_int;
+    bool             _active_high;
+    volatile bool    _irq;
+    key_event_t      _queue[kQUEUE_SIZE];
+    uint8_t          _head;
+    uint8_t          _tail;
+    bool             _lost;
+};
+
+#endif
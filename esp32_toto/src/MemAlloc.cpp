@@ -0,0 +1,124 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <esp_heap_caps.h>
+#include "MemAlloc.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const int kMAX_BLOCKS = 32;
+
+static const uint32_t kCAPS[] = {
+    MALLOC_CAP_DMA | MALLOC_CAP_8BIT,           // MEM_DMA
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,      // MEM_FAST
+    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,        // MEM_LARGE
+};
+
+static const char *kTYPE_NAMES[] = { "dma", "fast", "large" };
+
+/*
+*****************************************************************************************
+* VARIABLES
+*****************************************************************************************
+*/
+typedef struct _mem_block {
+    void       *ptr;
+    const char *tag;
+    uint32_t    size;
+    uint8_t     type;
+    bool        psram;
+} mem_block_t;
+
+static mem_block_t  _blocks[kMAX_BLOCKS];
+static uint32_t     _fallbacks;
+static portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+void *mem_alloc(size_t size, uint8_t type, const char *tag) {
+    bool  psram = (type == MEM_LARGE);
+    void *ptr   = heap_caps_malloc(size, kCAPS[type]);
+
+    // no PSRAM on this board or it is full : large buffers still work from internal RAM
+    if (!ptr && type == MEM_LARGE) {
+        ptr   = heap_caps_malloc(size, kCAPS[MEM_FAST]);
+        psram = false;
+        if (ptr)
+            __atomic_fetch_add(&_fallbacks, 1, __ATOMIC_RELAXED);
+    }
+    if (!ptr) {
+        LOG("mem_alloc %s : %u bytes of %s failed\n", tag, (unsigned)size, kTYPE_NAMES[type]);
+        return NULL;
+    }
+
+    portENTER_CRITICAL(&_mux);
+    for (int i = 0; i < kMAX_BLOCKS; i++) {
+        if (!_blocks[i].ptr) {
+            _blocks[i].ptr   = ptr;
+            _blocks[i].tag   = tag;
+            _blocks[i].size  = size;
+            _blocks[i].type  = type;
+            _blocks[i].psram = psram;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    return ptr;
+}
+
+void mem_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    portENTER_CRITICAL(&_mux);
+    for (int i = 0; i < kMAX_BLOCKS; i++) {
+        if (_blocks[i].ptr == ptr) {
+            _blocks[i].ptr = NULL;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_mux);
+    heap_caps_free(ptr);
+}
+
+void mem_report(Print &out) {
+    uint32_t total[2] = { 0, 0 };
+
+    out.printf("%-10s %-6s %-8s %8s\n", "tag", "type", "place", "bytes");
+    for (int i = 0; i < kMAX_BLOCKS; i++) {
+        mem_block_t blk = _blocks[i];
+
+        if (!blk.ptr)
+            continue;
+        out.printf("%-10s %-6s %-8s %8u\n", blk.tag, kTYPE_NAMES[blk.type], blk.psram ? "psram" : "internal",
+                   (unsigned)blk.size);
+        total[blk.psram] += blk.size;
+    }
+    out.printf("placed internal:%u psram:%u, large in internal:%u\n", (unsigned)total[0], (unsigned)total[1],
+               (unsigned)_fallbacks);
+    out.printf("internal free:%u min:%u largest:%u, dma largest:%u\n",
+               (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+               (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+               (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+               (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DMA));
+    out.printf("psram    free:%u min:%u largest:%u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+               (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM),
+               (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+}
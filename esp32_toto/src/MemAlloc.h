@@ -0,0 +1,42 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _MEM_ALLOC_H_
+#define _MEM_ALLOC_H_
+#include <Arduino.h>
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+enum : uint8_t {
+    MEM_DMA = 0,            // handed to a peripheral DMA (SD card, I2S), internal RAM only
+    MEM_FAST,               // touched every sample by the audio loop, internal RAM
+    MEM_LARGE,              // big and streamed through once, PSRAM when the board has it
+};
+
+/*
+*****************************************************************************************
+* FUNCTIONS
+*****************************************************************************************
+*/
+// audio buffers are placed by what they are used for instead of where malloc finds room,
+// so the internal RAM stays free for the stacks and drivers that can not live in PSRAM.
+// every live block is kept in a small table under its tag for mem_report()
+void *mem_alloc(size_t size, uint8_t type, const char *tag);
+void  mem_free(void *ptr);
+void  mem_report(Print &out);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "Metrics.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const int kBUCKETS = 16;
+
+enum : uint8_t {
+    HIST_LOG2 = 0,          // bucket n holds [2^(n-1), 2^n), durations
+    HIST_LINEAR,            // bucket n holds n, small counts
+};
+
+typedef struct _metric_desc {
+    const char *name;
+    uint8_t     scale;
+} metric_desc_t;
+
+static const metric_desc_t kMETRICS[MH_MAX] = {
+    { "underrun",        0 },
+    { "cache_hit",       0 },
+    { "cache_miss",      0 },
+    { "exp_queue_full",  0 },
+    { "render_us",       HIST_LOG2 },
+    { "sd_read_us",      HIST_LOG2 },
+    { "cache_fill_us",   HIST_LOG2 },
+    { "voices",          HIST_LINEAR },
+    { "loop_us",         HIST_LOG2 },
+};
+
+/*
+*****************************************************************************************
+* VARIABLES
+*****************************************************************************************
+*/
+typedef struct _metric_hist {
+    uint32_t    cnt;
+    uint32_t    min;
+    uint32_t    max;
+    uint64_t    sum;
+    uint32_t    buckets[kBUCKETS];
+} metric_hist_t;
+
+static uint32_t      _counters[MC_MAX_COUNTER];
+static metric_hist_t _hists[MH_MAX - MC_MAX_COUNTER];
+static uint32_t      _reset_ts;
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+void metric_inc(uint8_t id) {
+    if (id < MC_MAX_COUNTER)
+        __atomic_fetch_add(&_counters[id], 1, __ATOMIC_RELAXED);
+}
+
+void metric_add(uint8_t id, uint32_t value) {
+    if (id < MC_MAX_COUNTER || id >= MH_MAX)
+        return;
+
+    metric_hist_t *h = &_hists[id - MC_MAX_COUNTER];
+    int            b;
+
+    if (kMETRICS[id].scale == HIST_LINEAR)
+        b = value;
+    else
+        b = value ? 32 - __builtin_clz(value) : 0;
+
+    h->buckets[min(b, kBUCKETS - 1)]++;
+    h->min  = (h->cnt == 0 || value < h->min) ? value : h->min;
+    h->max  = max(value, h->max);
+    h->sum += value;
+    h->cnt++;
+}
+
+// one JSON object on one line, tagged so a script can pick it out of the console log
+void metric_dump(Print &out) {
+    out.printf("METRICS {\"build\":\"%s %s\",\"uptime_ms\":%u,\"window_ms\":%u", __DATE__, __TIME__,
+               (unsigned)millis(), (unsigned)(millis() - _reset_ts));
+
+    out.printf(",\"counters\":{");
+    for (int i = 0; i < MC_MAX_COUNTER; i++)
+        out.printf("%s\"%s\":%u", i ? "," : "", kMETRICS[i].name, (unsigned)_counters[i]);
+
+    out.printf("},\"hist\":{");
+    for (int i = MC_MAX_COUNTER; i < MH_MAX; i++) {
+        metric_hist_t *h = &_hists[i - MC_MAX_COUNTER];
+
+        out.printf("%s\"%s\":{\"scale\":\"%s\",\"n\":%u,\"min\":%u,\"max\":%u,\"sum\":%llu,\"b\":[",
+                   (i > MC_MAX_COUNTER) ? "," : "", kMETRICS[i].name,
+                   (kMETRICS[i].scale == HIST_LINEAR) ? "linear" : "log2", (unsigned)h->cnt, (unsigned)h->min,
+                   (unsigned)h->max, (unsigned long long)h->sum);
+        for (int b = 0; b < kBUCKETS; b++)
+            out.printf("%s%u", b ? "," : "", (unsigned)h->buckets[b]);
+        out.printf("]}");
+    }
+
+    // low water marks are kept by the heap itself, since boot. free against largest block
+    // tells how cut up a heap is
+    out.printf("},\"heap\":{\"internal_free\":%u,\"internal_min\":%u,\"internal_largest\":%u,"
+               "\"psram_free\":%u,\"psram_min\":%u,\"psram_largest\":%u}}\n",
+               (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(), (unsigned)ESP.getMaxAllocHeap(),
+               (unsigned)ESP.getFreePsram(), (unsigned)ESP.getMinFreePsram(), (unsigned)ESP.getMaxAllocPsram());
+}
+
+void metric_reset() {
+    for (int i = 0; i < MC_MAX_COUNTER; i++)
+        __atomic_store_n(&_counters[i], 0, __ATOMIC_RELAXED);
+    memset(_hists, 0, sizeof(_hists));
+    _reset_ts = millis();
+}
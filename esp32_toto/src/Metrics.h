@@ -0,0 +1,64 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+#include <Arduino.h>
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// keep in sync with the table in Metrics.cpp
+enum : uint8_t {
+    MC_UNDERRUN = 0,        // play pass later than the I2S DMA buffers last
+    MC_CACHE_HIT,
+    MC_CACHE_MISS,
+    MC_EXP_QUEUE_FULL,
+    MC_MAX_COUNTER,
+
+    MH_RENDER_US = MC_MAX_COUNTER,  // one pass of every running voice through the mixer
+    MH_SD_READ_US,          // file read behind a clip source
+    MH_CACHE_FILL_US,       // prefetch task, one entry
+    MH_VOICES,              // running voices per play pass
+    MH_LOOP_US,             // one whole loop() pass
+    MH_MAX
+};
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+#if __METRICS__
+#define METRIC_INC(id)          metric_inc(id)
+#define METRIC_ADD(id, value)   metric_add(id, value)
+#else
+#define METRIC_INC(id)
+#define METRIC_ADD(id, value)
+#endif
+
+/*
+*****************************************************************************************
+* FUNCTIONS
+*****************************************************************************************
+*/
+// counters can be bumped from any task, a histogram only from the one task that owns it
+void metric_inc(uint8_t id);
+void metric_add(uint8_t id, uint32_t value);
+void metric_dump(Print &out);
+void metric_reset();
+
+#endif
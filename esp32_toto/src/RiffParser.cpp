@@ -0,0 +1,219 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "RiffParser.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const int kMAX_CHUNKS = 32;          // a damaged file does not keep us walking
+static const int kFMT_LEN    = 40;          // fmt chunk of WAVE_FORMAT_EXTENSIBLE
+static const int kSMPL_LEN   = 36 + 24;     // sampler header and its first loop
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// the same walk over a card file and over an audio source
+class RiffReader {
+public:
+    virtual uint32_t read(uint8_t *buf, uint32_t len) = 0;
+    virtual bool     seek(uint32_t pos) = 0;
+    virtual uint32_t size() = 0;
+};
+
+class RiffFileReader : public RiffReader {
+public:
+    RiffFileReader(File &file) : _file(file) {}
+    uint32_t read(uint8_t *buf, uint32_t len)   { return _file.read(buf, len); }
+    bool     seek(uint32_t pos)                 { return _file.seek(pos); }
+    uint32_t size()                             { return _file.size(); }
+
+private:
+    File &_file;
+};
+
+class RiffSourceReader : public RiffReader {
+public:
+    RiffSourceReader(AudioFileSource *src) : _src(src) {}
+    uint32_t read(uint8_t *buf, uint32_t len)   { return _src->read(buf, len); }
+    bool     seek(uint32_t pos)                 { return _src->seek(pos, SEEK_SET); }
+    uint32_t size()                             { return _src->getSize(); }
+
+private:
+    AudioFileSource *_src;
+};
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static bool is_chunk_id(const uint8_t *id) {
+    for (int i = 0; i < 4; i++) {
+        if (id[i] < 0x20 || id[i] > 0x7e)
+            return false;
+    }
+    return true;
+}
+
+// how much a header looks like a chunk at pos : 0 not an id, 1 an id running past the end
+// of the file, 2 an id that fits, 3 one of the ids clips are made of
+static int chunk_score(const uint8_t *hdr, uint32_t pos, uint32_t size) {
+    static const char *known[] = { "fmt ", "data", "smpl", "LIST", "fact", "cue " };
+
+    if (!is_chunk_id(hdr))
+        return 0;
+    for (int i = 0; i < (int)ARRAY_SIZE(known); i++) {
+        if (!memcmp(hdr, known[i], 4))
+            return 3;
+    }
+    return (pos + 8 <= size && get_u32(hdr + 4) <= size - pos - 8) ? 2 : 1;
+}
+
+static bool parse(RiffReader &rd, wav_info_t *info) {
+    uint8_t  hdr[kSMPL_LEN];
+    uint32_t size = rd.size();
+    uint32_t pos  = 12;
+    bool     odd  = false;
+    bool     fmt  = false;
+
+    memset(info, 0, sizeof(wav_info_t));
+    if (!rd.seek(0) || rd.read(hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4))
+        return false;
+
+    for (int i = 0; i < kMAX_CHUNKS && pos + 8 <= size; i++) {
+        if (!rd.seek(pos) || rd.read(hdr, 8) != 8)
+            return false;
+
+        // some writers leave out the pad byte after an odd sized chunk, the id then starts
+        // one byte early. Read there, 3 id characters and a length byte are often printable
+        // too, so a known id or a length that fits decides which one is the chunk
+        int score = chunk_score(hdr, pos, size);
+        if (odd && score < 3) {
+            uint8_t alt[8];
+
+            if (rd.seek(pos - 1) && rd.read(alt, 8) == 8 && chunk_score(alt, pos - 1, size) > score) {
+                memcpy(hdr, alt, 8);
+                score = chunk_score(hdr, --pos, size);
+            }
+            // bodies are read from right behind the header
+            if (!rd.seek(pos + 8))
+                return false;
+        }
+        if (score == 0)
+            return false;
+
+        uint32_t len  = get_u32(hdr + 4);
+        uint32_t body = pos + 8;
+
+        if (!memcmp(hdr, "fmt ", 4) && len >= 16) {
+            uint32_t n = min(len, (uint32_t)kFMT_LEN);
+
+            if (rd.read(hdr, n) != n)
+                return false;
+            info->format   = get_u16(hdr);
+            info->channels = get_u16(hdr + 2);
+            info->rate     = get_u32(hdr + 4);
+            info->align    = get_u16(hdr + 12);
+            info->bits     = get_u16(hdr + 14);
+
+            // cbSize, valid bits and channel mask come first, the real format tag is the
+            // start of the sub format GUID
+            if (info->format == WAVE_FORMAT_EXTENSIBLE && n >= 26)
+                info->format = get_u16(hdr + 24);
+            fmt = true;
+        } else if (!memcmp(hdr, "data", 4)) {
+            info->data_ofs = body;
+            info->data_len = (len == 0 || len > size - body) ? size - body : len;
+        } else if (!memcmp(hdr, "smpl", 4) && len >= (uint32_t)kSMPL_LEN) {
+            if (rd.read(hdr, kSMPL_LEN) != (uint32_t)kSMPL_LEN)
+                return false;
+
+            // loops follow the 36 byte sampler header, only a forward loop (type 0) is
+            // played. Its end is the last frame of the loop
+            if (get_u32(hdr + 28) > 0 && get_u32(hdr + 36 + 4) == 0) {
+                info->loop_start = get_u32(hdr + 36 + 8);
+                info->loop_end   = get_u32(hdr + 36 + 12) + 1;
+            }
+        }
+
+        // nothing follows a chunk that runs past the end of the file
+        if (len > size - body)
+            break;
+        odd = len & 1;
+        pos = body + len + odd;
+    }
+
+    if (!fmt || !info->data_ofs || !info->channels)
+        return false;
+    if (!info->align)
+        info->align = info->channels * info->bits / 8;
+    if (!info->align)
+        return false;
+    info->data_len -= info->data_len % info->align;
+
+    // a loop has to lie inside the samples
+    if (info->loop_end > info->data_len / info->align || info->loop_start >= info->loop_end)
+        info->loop_start = info->loop_end = 0;
+
+    return info->data_len > 0;
+}
+
+bool riff_parse(File &file, wav_info_t *info) {
+    RiffFileReader rd(file);
+
+    return parse(rd, info);
+}
+
+bool riff_parse(AudioFileSource *src, wav_info_t *info) {
+    RiffSourceReader rd(src);
+
+    return parse(rd, info);
+}
+
+void riff_make_header(const wav_info_t *info, uint32_t data_len, uint8_t *hdr) {
+    memcpy(hdr, "RIFF", 4);
+    put_u32(hdr + 4, data_len + WAV_HEADER_LEN - 8);
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    put_u32(hdr + 16, 16);
+    put_u16(hdr + 20, info->format);
+    put_u16(hdr + 22, info->channels);
+    put_u32(hdr + 24, info->rate);
+    put_u32(hdr + 28, info->rate * info->align);
+    put_u16(hdr + 32, info->align);
+    put_u16(hdr + 34, info->bits);
+    memcpy(hdr + 36, "data", 4);
+    put_u32(hdr + 40, data_len);
+}
@@ -0,0 +1,64 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _RIFF_PARSER_H_
+#define _RIFF_PARSER_H_
+#include <Arduino.h>
+#include "AudioFileSource.h"
+#include "FS.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+#define WAV_HEADER_LEN          44      // canonical RIFF + fmt + data header
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+typedef struct _wav_info {
+    uint16_t    format;         // the sub format for WAVE_FORMAT_EXTENSIBLE
+    uint16_t    channels;
+    uint32_t    rate;
+    uint16_t    bits;
+    uint16_t    align;          // bytes per frame
+    uint32_t    data_ofs;       // first PCM byte in the file
+    uint32_t    data_len;       // whole frames, cut to what the file really holds
+    uint32_t    loop_start;     // first sustain loop of "smpl" in frames, end excluded,
+    uint32_t    loop_end;       // 0 when there is none
+} wav_info_t;
+
+/*
+*****************************************************************************************
+* FUNCTIONS
+*****************************************************************************************
+*/
+// one walk over the chunks of a clip for every reader of it. Chunks it does not need
+// (LIST, fact, cue, ...) are skipped, odd sized chunks with or without their pad byte
+// are both found, and a data size of 0 or past the end of the file (streamed writers)
+// is taken as the rest of the file. "smpl" usually follows the samples, so the walk
+// goes on behind "data" with a seek. The reader is left anywhere
+bool riff_parse(File &file, wav_info_t *info);
+bool riff_parse(AudioFileSource *src, wav_info_t *info);
+
+// canonical PCM header for info with data_len bytes, what AudioGeneratorWAV reads fastest
+void riff_make_header(const wav_info_t *info, uint32_t data_len, uint8_t *hdr);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "SerialLink.h"
+#include "MemAlloc.h"
+#include "Metrics.h"
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+static uint16_t crc16(const uint8_t *buf, int len) {
+    uint16_t crc = 0xffff;
+
+    while (len--) {
+        crc ^= *buf++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, int len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// every zero is replaced by the distance to the next one, the frame itself has none
+static int cobs_encode(const uint8_t *src, int len, uint8_t *dst) {
+    int code_pos = 0;
+    int out      = 1;
+    uint8_t code = 1;
+
+    for (int i = 0; i < len; i++) {
+        if (src[i]) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (!src[i] || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code     = 1;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+// returns the decoded length, -1 for a malformed frame
+static int cobs_decode(const uint8_t *src, int len, uint8_t *dst) {
+    int out = 0;
+
+    for (int i = 0; i < len;) {
+        uint8_t code = src[i++];
+
+        if (code == 0 || i + code - 1 > len)
+            return -1;
+        for (int j = 1; j < code; j++)
+            dst[out++] = src[i++];
+        if (code < 0xff && i < len)
+            dst[out++] = 0;
+    }
+    return out;
+}
+
+// metrics JSON cut into response frames
+class LinkPrint : public Print {
+public:
+    LinkPrint(SerialLink *link, uint8_t cmd, uint8_t seq) : _link(link), _cmd(cmd), _seq(seq), _fill(0) { }
+
+    virtual size_t write(uint8_t c) {
+        _buf[_fill++] = c;
+        if (_fill == sizeof(_buf))
+            flush_more();
+        return 1;
+    }
+
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            write(buf[i]);
+        return size;
+    }
+
+    void flush_more() {
+        if (_fill)
+            _link->reply(_cmd, _seq, LINK_MORE, _buf, _fill);
+        _fill = 0;
+    }
+
+private:
+    SerialLink *_link;
+    uint8_t     _cmd;
+    uint8_t     _seq;
+    uint8_t     _buf[SerialLink::kMAX_PAYLOAD];
+    int         _fill;
+};
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+SerialLink::SerialLink(HardwareSerial &serial, fs::FS &fs, const char *upload_path) : _serial(serial), _fs(fs) {
+    _task        = NULL;
+    _queue       = NULL;
+    _tx_lock     = NULL;
+    _rx_len      = 0;
+    _rx_ts       = 0;
+    _rx_eol      = false;
+    _upload_path = upload_path;
+    _up_buf      = NULL;
+    _up_state    = UP_IDLE;
+}
+
+bool SerialLink::begin(int core) {
+    _queue   = xQueueCreate(kQUEUE_LEN, sizeof(link_cmd_t));
+    _tx_lock = xSemaphoreCreateMutex();
+    if (!_queue || !_tx_lock)
+        return false;
+
+    return xTaskCreatePinnedToCore(task, "link", 4096, this, 2, &_task, core) == pdPASS;
+}
+
+// audio loop : never waits
+bool SerialLink::get_cmd(link_cmd_t *cmd) {
+    return _queue && xQueueReceive(_queue, cmd, 0) == pdTRUE;
+}
+
+// both tasks answer, a leading delimiter splits the frame from any console text before it
+void SerialLink::reply(uint8_t cmd, uint8_t seq, uint8_t status, const void *data, int len) {
+    len = min(len, (int)kMAX_PAYLOAD);
+
+    xSemaphoreTake(_tx_lock, portMAX_DELAY);
+    _raw[0] = cmd | LINK_RSP;
+    _raw[1] = seq;
+    _raw[2] = status;
+    if (len > 0)
+        memcpy(&_raw[3], data, len);
+
+    uint16_t crc = crc16(_raw, len + 3);
+    _raw[len + 3] = crc & 0xff;
+    _raw[len + 4] = crc >> 8;
+
+    int n = cobs_encode(_raw, len + 5, &_tx[1]);
+    _tx[0]     = 0;
+    _tx[n + 1] = 0;
+    _serial.write(_tx, n + 2);
+    xSemaphoreGive(_tx_lock);
+}
+
+void SerialLink::on_frame(uint8_t *frame, int len) {
+    int n = cobs_decode(frame, len, _frame);
+
+    if (n < 4 || crc16(_frame, n - 2) != (_frame[n - 2] | (_frame[n - 1] << 8)))
+        return;
+
+    uint8_t cmd = _frame[0];
+    uint8_t seq = _frame[1];
+
+    if (handle(cmd, seq, &_frame[2], n - 4))
+        return;
+
+    // the rest runs in loop() between two audio passes
+    link_cmd_t req;
+    req.cmd = cmd;
+    req.seq = seq;
+    req.len = min(n - 4, (int)sizeof(req.arg));
+    memcpy(req.arg, &_frame[2], req.len);
+    if (xQueueSend(_queue, &req, 0) != pdTRUE)
+        reply(cmd, seq, LINK_ERR_STATE);
+}
+
+// a serial monitor : the key goes to loop() like LINK_KEY, nothing is sent back
+void SerialLink::on_console(uint8_t c) {
+    link_cmd_t req;
+
+    _rx_eol = true;
+    if (c < 0x20 || c > 0x7e)
+        return;
+    req.cmd    = LINK_CONSOLE;
+    req.seq    = 0;
+    req.len    = 1;
+    req.arg[0] = c;
+    xQueueSend(_queue, &req, 0);
+}
+
+// the commands that do not need the audio chain, true when answered here
+bool SerialLink::handle(uint8_t cmd, uint8_t seq, uint8_t *arg, int len) {
+    uint8_t  buf[kMAX_PAYLOAD];
+    uint32_t size;
+    char     path[64];
+
+    switch (cmd) {
+        case LINK_PING:
+            buf[0] = LINK_VERSION;
+            reply(cmd, seq, LINK_OK, buf, 1);
+            return true;
+
+        case LINK_SET_BAUD:
+            if (len < 4) {
+                reply(cmd, seq, LINK_ERR_ARG);
+                return true;
+            }
+            reply(cmd, seq, LINK_OK);
+            _serial.flush();
+            _serial.updateBaudRate(get_u32(arg));
+            return true;
+
+        case LINK_UPLOAD_BEGIN:
+        case LINK_UPLOAD_DATA:
+            return handle_upload(cmd, seq, arg, len);
+
+        case LINK_UPLOAD_END:
+            // a retried END after a busy answer skips straight to loop()
+            return (_up_state == UP_DONE) ? false : handle_upload(cmd, seq, arg, len);
+
+        case LINK_METRICS:
+            if (true) {
+                LinkPrint out(this, cmd, seq);
+
+                metric_dump(out);
+                out.flush_more();
+            }
+            reply(cmd, seq, LINK_OK);
+            return true;
+
+        case LINK_FILE_OPEN:
+            if (len < 2 || len - 1 >= (int)sizeof(path) || (arg[0] != 'r' && arg[0] != 'w')) {
+                reply(cmd, seq, LINK_ERR_ARG);
+                return true;
+            }
+            memcpy(path, &arg[1], len - 1);
+            path[len - 1] = 0;
+            if (_file)
+                _file.close();
+            _file = _fs.open(path, (arg[0] == 'w') ? FILE_WRITE : FILE_READ);
+            if (!_file) {
+                reply(cmd, seq, LINK_ERR_IO);
+                return true;
+            }
+            size = _file.size();
+            reply(cmd, seq, LINK_OK, &size, sizeof(size));
+            return true;
+
+        case LINK_FILE_WRITE:
+            if (!_file)
+                reply(cmd, seq, LINK_ERR_STATE);
+            else
+                reply(cmd, seq, (_file.write(arg, len) == (size_t)len) ? LINK_OK : LINK_ERR_IO);
+            return true;
+
+        case LINK_FILE_READ:
+            if (!_file) {
+                reply(cmd, seq, LINK_ERR_STATE);
+                return true;
+            }
+            size = _file.read(buf, (len > 0 && arg[0]) ? min((int)arg[0], (int)kMAX_PAYLOAD) : kMAX_PAYLOAD);
+            reply(cmd, seq, LINK_OK, buf, size);
+            return true;
+
+        case LINK_FILE_CLOSE:
+            if (_file)
+                _file.close();
+            reply(cmd, seq, LINK_OK);
+            return true;
+
+        case LINK_KEY:
+        case LINK_PLAY:
+        case LINK_STOP:
+        case LINK_SET_GAIN:
+        case LINK_REC_START:
+        case LINK_REC_STOP:
+            return false;
+    }
+    reply(cmd, seq, LINK_ERR_CMD);
+    return true;
+}
+
+// whole buffers only until the end, so every card write starts on a sector boundary
+bool SerialLink::flush_upload() {
+    bool ok = _up_file.write(_up_buf, _up_fill) == (size_t)_up_fill;
+
+    _up_fill = 0;
+    return ok;
+}
+
+// the transfer is dropped : the DMA buffer goes back and no partial file is left on the card
+void SerialLink::abort_upload() {
+    if (_up_file)
+        _up_file.close();
+    mem_free(_up_buf);
+    _up_buf   = NULL;
+    _fs.remove(_upload_path);
+    _up_state = UP_IDLE;
+}
+
+bool SerialLink::handle_upload(uint8_t cmd, uint8_t seq, uint8_t *arg, int len) {
+    uint32_t val;
+
+    switch (cmd) {
+        case LINK_UPLOAD_BEGIN:
+            len -= 4;
+            if (len < 5 || len >= (int)sizeof(_up_name) || _up_state == UP_DONE) {
+                reply(cmd, seq, (_up_state == UP_DONE) ? LINK_ERR_STATE : LINK_ERR_ARG);
+                return true;
+            }
+            memcpy(_up_name, &arg[4], len);
+            _up_name[len] = 0;
+            if (strchr(_up_name, '/') || strcasecmp(_up_name + len - 4, ".wav")) {
+                reply(cmd, seq, LINK_ERR_ARG);
+                return true;
+            }
+
+            if (!_up_buf)
+                _up_buf = (uint8_t *)mem_alloc(kUPLOAD_BUF, MEM_DMA, "upload");
+            if (_up_file)
+                _up_file.close();
+            _up_file = _fs.open(_upload_path, FILE_WRITE);
+            if (!_up_buf || !_up_file) {
+                reply(cmd, seq, LINK_ERR_IO);
+                return true;
+            }
+            _up_size  = get_u32(arg);
+            _up_pos   = 0;
+            _up_fill  = 0;
+            _up_crc   = 0;
+            _up_gap   = false;
+            _up_ts    = millis();
+            _up_state = UP_RECEIVING;
+            reply(cmd, seq, LINK_OK);
+            return true;
+
+        case LINK_UPLOAD_DATA:
+            if (_up_state != UP_RECEIVING || len < 4)
+                return true;
+            _up_ts = millis();
+
+            // a lost frame : tell the host once where to go on from, drop the rest
+            val = get_u32(arg);
+            if (val != _up_pos || _up_pos + (len - 4) > _up_size) {
+                if (!_up_gap)
+                    reply(cmd, seq, LINK_ERR_ARG, &_up_pos, sizeof(_up_pos));
+                _up_gap = true;
+                return true;
+            }
+            _up_gap = false;
+            arg += 4;
+            len -= 4;
+            _up_crc = crc32_update(_up_crc, arg, len);
+            _up_pos += len;
+            while (len > 0) {
+                int n = min(len, kUPLOAD_BUF - _up_fill);
+
+                memcpy(_up_buf + _up_fill, arg, n);
+                _up_fill += n;
+                arg      += n;
+                len      -= n;
+                if (_up_fill == kUPLOAD_BUF && !flush_upload()) {
+                    abort_upload();
+                    reply(cmd, seq, LINK_ERR_IO);
+                    return true;
+                }
+            }
+            return true;
+
+        case LINK_UPLOAD_END:
+            if (_up_state != UP_RECEIVING || len < 4) {
+                reply(cmd, seq, LINK_ERR_STATE);
+                return true;
+            }
+            if (_up_pos != _up_size) {
+                _up_gap = false;
+                reply(cmd, seq, LINK_ERR_ARG, &_up_pos, sizeof(_up_pos));
+                return true;
+            }
+
+            val = flush_upload();
+            if (!val || get_u32(arg) != _up_crc) {
+                abort_upload();
+                reply(cmd, seq, val ? LINK_ERR_ARG : LINK_ERR_IO);
+                return true;
+            }
+            _up_file.close();
+            mem_free(_up_buf);
+            _up_buf   = NULL;
+            _up_state = UP_DONE;
+            return false;
+    }
+    return true;
+}
+
+void SerialLink::task(void *arg) {
+    SerialLink *link = (SerialLink *)arg;
+    uint8_t     buf[64];
+
+    for (;;) {
+        int n = link->_serial.available();
+
+        if (n <= 0) {
+            // a frame never pauses : what is left is a broken frame, text or a character
+            // that never got its line end, dropped so the next character is seen alone.
+            // Line noise on a quiet port must not run a command on its own
+            if (link->_rx_len > 0 && millis() - link->_rx_ts >= kCONSOLE_GAP_MS)
+                link->_rx_len = 0;
+            if (link->_up_state == UP_RECEIVING && millis() - link->_up_ts >= kUPLOAD_TIMEOUT_MS)
+                link->abort_upload();
+            vTaskDelay(1);
+            continue;
+        }
+
+        n = link->_serial.readBytes(buf, min(n, (int)sizeof(buf)));
+        for (int i = 0; i < n; i++) {
+            bool eol = (buf[i] == '\r' || buf[i] == '\n');
+
+            if (buf[i] == 0) {
+                if (link->_rx_len > 0)
+                    link->on_frame(link->_rx, link->_rx_len);
+                link->_rx_len = 0;
+                link->_rx_eol = false;
+            } else if (eol && (link->_rx_len == 1 || (link->_rx_len == 0 && link->_rx_eol))) {
+                // no command is CR or LF, so the second byte of a frame never is one either
+                if (link->_rx_len == 1)
+                    link->on_console(link->_rx[0]);
+                link->_rx_len = 0;
+            } else if (link->_rx_len < (int)sizeof(link->_rx)) {
+                link->_rx[link->_rx_len++] = buf[i];
+                link->_rx_ts  = millis();
+                link->_rx_eol = false;
+            } else {
+                // oversized, the crc will fail on what is left of it
+                link->_rx_len = 0;
+            }
+        }
+    }
+}
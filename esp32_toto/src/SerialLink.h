@@ -0,0 +1,154 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERIAL_LINK_H_
+#define _SERIAL_LINK_H_
+#include <Arduino.h>
+#include "FS.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// request  : COBS(cmd, seq, args.., crc16) 0x00
+// response : COBS(cmd | LINK_RSP, seq, status, data.., crc16) 0x00
+// crc16 is CCITT (0x1021, init 0xffff) over everything before it, little endian.
+// A bad frame is dropped without a response, the host retries on a timeout.
+// tools/toto_link.cpp is the host side, it keeps a copy of these numbers.
+// A host starts every request with a 0x00 too. A single printable character outside a
+// frame, ended by CR / LF, is a console command typed on a serial monitor (set it to send
+// a line ending, a character on its own is dropped after kCONSOLE_GAP_MS)
+enum : uint8_t {
+    LINK_PING = 0x01,           // -> version
+    LINK_KEY,                   // char : one of the console commands of loop()
+    LINK_SET_BAUD,              // baud (u32), answered at the old rate then switched
+
+    LINK_PLAY = 0x10,           // clip id (u16) -> slot
+    LINK_STOP,                  // slot, LINK_ALL for every voice
+    LINK_SET_GAIN,              // slot or LINK_ALL for the master, gain (u16, 1/256)
+    LINK_REC_START,
+    LINK_REC_STOP,
+
+    LINK_METRICS = 0x20,        // -> JSON text, LINK_MORE frames then LINK_OK
+
+    LINK_FILE_OPEN = 0x30,      // mode ('r', 'w'), path -> size (u32)
+    LINK_FILE_WRITE,            // data
+    LINK_FILE_READ,             // max len (u8) -> data, empty at the end of the file
+    LINK_FILE_CLOSE,
+
+    // clip upload : DATA is streamed without answers, only a gap is answered once with
+    // LINK_ERR_ARG and the expected offset. END checks size and crc32 of the whole file
+    // and has the clip swapped in by loop() while nothing plays, LINK_ERR_STATE : retry
+    LINK_UPLOAD_BEGIN = 0x38,   // size (u32), clip name
+    LINK_UPLOAD_DATA,           // offset (u32), data
+    LINK_UPLOAD_END,            // crc32 (u32) -> offset (u32) on a short file
+
+    LINK_CONSOLE = 0x7f,        // char typed outside a frame, only queued for loop(), no answer
+};
+
+enum : uint8_t {
+    LINK_OK = 0,
+    LINK_MORE,                  // more response frames follow for the same seq
+    LINK_ERR_CMD,
+    LINK_ERR_ARG,
+    LINK_ERR_STATE,
+    LINK_ERR_IO,
+};
+
+#define LINK_RSP                0x80
+#define LINK_ALL                0xFF
+#define LINK_VERSION            1
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+// a request for loop(), the ones that touch the audio chain
+typedef struct _link_cmd {
+    uint8_t     cmd;
+    uint8_t     seq;
+    uint8_t     len;
+    uint8_t     arg[8];
+} link_cmd_t;
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// owns the UART receive side on a task of its own : frames are decoded and checked there,
+// metrics and file transfers are answered there too. Only the audio commands are queued
+// for loop(), which picks them up without waiting and answers with reply()
+class SerialLink {
+public:
+    enum : int { kMAX_PAYLOAD = 240,
+                 kQUEUE_LEN = 8 };
+
+    SerialLink(HardwareSerial &serial, fs::FS &fs, const char *upload_path);
+
+    bool        begin(int core = 0);
+    bool        get_cmd(link_cmd_t *cmd);
+    void        reply(uint8_t cmd, uint8_t seq, uint8_t status, const void *data = NULL, int len = 0);
+    const char *get_upload_path()   { return _upload_path; }
+    const char *get_upload_name()   { return (_up_state == UP_DONE) ? _up_name : NULL; }
+    void        end_upload()        { _up_state = UP_IDLE; }
+
+private:
+    enum : int { kMAX_FRAME = kMAX_PAYLOAD + 8,
+                 kMAX_COBS = kMAX_FRAME + kMAX_FRAME / 254 + 2,
+                 kUPLOAD_BUF = 4096,        // 8 sectors per card write
+                 kUPLOAD_TIMEOUT_MS = 5000, // a host that went quiet mid upload has given up
+                 kCONSOLE_GAP_MS = 50 };    // a frame from the host never pauses that long, a partial is stale
+    enum : uint8_t { UP_IDLE = 0,
+                     UP_RECEIVING,
+                     UP_DONE };             // verified, waiting for loop() to swap it in
+
+    static void task(void *arg);
+    void        on_frame(uint8_t *frame, int len);
+    void        on_console(uint8_t c);
+    bool        handle(uint8_t cmd, uint8_t seq, uint8_t *arg, int len);
+    bool        handle_upload(uint8_t cmd, uint8_t seq, uint8_t *arg, int len);
+    bool        flush_upload();
+    void        abort_upload();
+
+    HardwareSerial   &_serial;
+    fs::FS           &_fs;
+    TaskHandle_t      _task;
+    QueueHandle_t     _queue;
+    SemaphoreHandle_t _tx_lock;
+    uint8_t           _rx[kMAX_COBS];
+    int               _rx_len;
+    uint32_t          _rx_ts;
+    bool              _rx_eol;              // CR / LF after a console character are dropped
+    uint8_t           _frame[kMAX_COBS];
+    uint8_t           _raw[kMAX_FRAME];
+    uint8_t           _tx[kMAX_COBS];
+    File              _file;
+
+    const char       *_upload_path;
+    File              _up_file;
+    uint8_t          *_up_buf;
+    int               _up_fill;
+    uint32_t          _up_size;
+    uint32_t          _up_pos;
+    uint32_t          _up_crc;
+    uint32_t          _up_ts;               // last upload frame
+    bool              _up_gap;
+    volatile uint8_t  _up_state;
+    char              _up_name[48];
+};
+
+#endif
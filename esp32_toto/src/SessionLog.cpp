@@ -0,0 +1,115 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include <sys/time.h>
+#include "SessionLog.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const uint32_t kRTC_MAGIC = 0x474f4c53;      // "SLOG"
+static const uint32_t kRETRY_MS   = 5000;
+
+/*
+*****************************************************************************************
+* VARIABLES
+*****************************************************************************************
+*/
+// RTC slow memory keeps the events of a wake up that went back to sleep before a flush
+RTC_DATA_ATTR static uint32_t        _rtc_magic;
+RTC_DATA_ATTR static uint16_t        _rtc_head;
+RTC_DATA_ATTR static uint16_t        _rtc_tail;
+RTC_DATA_ATTR static session_event_t _rtc_ring[SessionLog::kRING_SIZE];
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+static uint32_t get_ts() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+SessionLog::SessionLog(fs::FS &fs, const char *path) : _fs(fs) {
+    _path     = path;
+    _last_add = 0;
+    _failed   = false;
+}
+
+void SessionLog::begin() {
+    // cold boot, RTC memory is garbage
+    if (_rtc_magic != kRTC_MAGIC) {
+        _rtc_head  = 0;
+        _rtc_tail  = 0;
+        _rtc_magic = kRTC_MAGIC;
+    }
+    add(SESSION_BOOT, SESSION_KEY_NONE, 0);
+}
+
+void SessionLog::add(uint8_t type, uint8_t key, uint16_t clip) {
+    // full : the oldest events go, a long session without a card still keeps its end
+    if ((uint16_t)(_rtc_head - _rtc_tail) >= kRING_SIZE)
+        _rtc_tail++;
+
+    session_event_t *evt = &_rtc_ring[_rtc_head & (kRING_SIZE - 1)];
+    evt->ts   = get_ts();
+    evt->clip = clip;
+    evt->key  = key;
+    evt->type = type;
+    _rtc_head++;
+    _last_add = millis();
+}
+
+int SessionLog::get_pending() {
+    return (uint16_t)(_rtc_head - _rtc_tail);
+}
+
+// one append per batch, at most two writes when the ring wraps
+int SessionLog::flush() {
+    int cnt = get_pending();
+
+    // no card : keep the events in the ring and retry now and then
+    if (cnt == 0 || (_failed && !IS_ELAPSED(millis(), _fail_ts, kRETRY_MS)))
+        return 0;
+
+    File file = _fs.open(_path, FILE_APPEND);
+    _failed = !file;
+    if (!file) {
+        _fail_ts = millis();
+        return -1;
+    }
+
+    int done = 0;
+    while (done < cnt) {
+        uint16_t idx = (_rtc_tail + done) & (kRING_SIZE - 1);
+        int      len = min(cnt - done, kRING_SIZE - idx);
+
+        if (file.write((uint8_t *)&_rtc_ring[idx], len * sizeof(session_event_t)) != len * sizeof(session_event_t))
+            break;
+        done += len;
+    }
+    file.close();
+    _rtc_tail += done;
+
+    return done;
+}
+
+bool SessionLog::clear() {
+    _rtc_tail = _rtc_head;
+    return !_fs.exists(_path) || _fs.remove(_path);
+}
@@ -0,0 +1,71 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SESSION_LOG_H_
+#define _SESSION_LOG_H_
+#include <Arduino.h>
+#include "FS.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+enum : uint8_t {
+    SESSION_BOOT = 0,               // power up or wake up, starts a new segment
+    SESSION_KEY,                    // word played by a key
+    SESSION_PHRASE_ADD,             // word added to the sentence being composed
+    SESSION_PHRASE_PLAY,            // sentence played, key = gap between the words in 10ms
+    SESSION_GAIN,                   // master gain changed, clip = gain in 1/256
+};
+
+#define SESSION_KEY_NONE        0xFF    // played from the serial console
+
+typedef struct __attribute__((packed)) _session_event {
+    uint32_t    ts;                 // ms, RTC based so it keeps counting through deep sleep
+    uint16_t    clip;               // ClipLibrary::get_id()
+    uint8_t     key;
+    uint8_t     type;
+} session_event_t;
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// key presses kept in an RTC memory ring that survives deep sleep, appended to a file on
+// the card in batches while nothing is playing
+class SessionLog {
+public:
+    enum : int { kRING_SIZE = 128 };    // power of 2
+
+    SessionLog(fs::FS &fs, const char *path);
+
+    void     begin();
+    void     add(uint8_t type, uint8_t key, uint16_t clip);
+    int      flush();
+    bool     clear();
+    int      get_pending();
+    uint32_t get_last_add()         { return _last_add; }
+    const char *get_path()          { return _path; }
+
+private:
+    fs::FS      &_fs;
+    const char  *_path;
+    uint32_t     _last_add;
+    uint32_t     _fail_ts;
+    bool         _failed;
+};
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "SessionRender.h"
+#include "WAVFileWriter.h"
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// end of the render chain in place of the I2S output. It pushes back at the frame the
+// render has got to, like the I2S DMA does at real time, so the voices are paced by the
+// script. Every sample goes through a FNV-1a hash, the file is optional
+class AudioOutputWAVFile : public AudioOutput
+{
+  public:
+    enum : int { kBUF = 256 };
+
+    AudioOutputWAVFile(WAVFileWriter *writer) { this->writer = writer; fill = 0; frames = 0; limit = 0; hash = 2166136261u; }
+    virtual bool begin() override { return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override
+    {
+      if (frames >= limit) return false;
+      int16_t s = (sample[LEFTCHANNEL] + sample[RIGHTCHANNEL]) >> 1;
+      hash = (hash ^ (uint8_t)s) * 16777619u;
+      hash = (hash ^ (uint8_t)(s >> 8)) * 16777619u;
+      buf[fill++] = s;
+      frames++;
+      if (fill == kBUF) flush();
+      return true;
+    }
+    virtual void flush() override
+    {
+      if (fill && writer) writer->write(buf, fill);
+      fill = 0;
+    }
+    virtual bool stop() override { return true; }
+    void SetLimit(uint32_t frame) { limit = frame; }
+    uint32_t GetFrames() { return frames; }
+    uint32_t GetHash() { return hash; }
+
+  protected:
+    WAVFileWriter *writer;
+    int16_t buf[kBUF];
+    int fill;
+    uint32_t frames;
+    uint32_t limit;
+    uint32_t hash;
+};
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+SessionRender::SessionRender(ClipLibrary &library, float headroom, int max_gap_ms) : _library(library) {
+    _headroom   = headroom;
+    _max_gap_ms = max_gap_ms;
+    _hash       = 0;
+    _frames     = 0;
+}
+
+// a free voice, or the first one cut short like the live player does
+int SessionRender::get_slot() {
+    for (int i = 0; i < kMAX_MIX; i++) {
+        if (!_gen[i]->isRunning())
+            return i;
+    }
+    stop_voice(0);
+    return 0;
+}
+
+// the mixer inputs live as long as the render, a stopped voice only stops its input
+void SessionRender::stop_voice(int slot) {
+    if (_gen[slot]->isRunning())
+        _gen[slot]->stop();
+}
+
+void SessionRender::start_voice(int slot, AudioFileSource *src, float gain) {
+    _stub[slot]->SetGain(gain / _headroom);
+    _playing[slot] = src;
+    _gen[slot]->begin(src, _stub[slot]);
+}
+
+void SessionRender::service() {
+    for (int i = 0; i < kMAX_MIX; i++) {
+        if (_gen[i]->isRunning() && !_gen[i]->loop())
+            stop_voice(i);
+    }
+    // nothing left to wait for, the mixer would drain its empty buffer into the sink forever
+    if (is_running())
+        _mixer->loop();
+}
+
+bool SessionRender::is_running() {
+    for (int i = 0; i < kMAX_MIX; i++) {
+        if (_gen[i]->isRunning())
+            return true;
+    }
+    return false;
+}
+
+// run the voices up to frame, silence fills whatever they do not cover
+void SessionRender::advance(uint32_t frame) {
+    AudioOutputWAVFile *sink = (AudioOutputWAVFile *)_sink;
+    int16_t             zero[2] = { 0, 0 };
+
+    sink->SetLimit(frame);
+    while (sink->GetFrames() < frame) {
+        if (is_running())
+            service();
+        else
+            _limiter->ConsumeSample(zero);
+    }
+}
+
+void SessionRender::handle(session_event_t *evt) {
+    clip_info_t *clip = _library.find_by_id(evt->clip);
+    wav_info_t   info;
+    bool         known = clip && ClipLibrary::get_wav_info(clip, &info);
+    int          slot;
+
+    switch (evt->type) {
+        case SESSION_KEY:
+            if (clip) {
+                String path = _library.get_path(clip);
+
+                slot = get_slot();
+                if (known ? _pcm[slot]->OpenAt(path.c_str(), &info) : _pcm[slot]->open(path.c_str()))
+                    start_voice(slot, _pcm[slot], clip->gain / (float)CLIP_GAIN_UNITY);
+            }
+            break;
+
+        case SESSION_PHRASE_ADD:
+            if (_phrase_played) {
+                _phrase->Clear();
+                _phrase_played = false;
+            }
+            if (clip)
+                _phrase->Add(_library.get_path(clip).c_str(), clip->gain, known ? &info : NULL);
+            break;
+
+        case SESSION_PHRASE_PLAY:
+            // the sentence restarts from its first word, take it off a voice still reading it
+            for (int i = 0; i < kMAX_MIX; i++) {
+                if (_playing[i] == _phrase)
+                    stop_voice(i);
+            }
+            _phrase->SetGap(evt->key * 10);
+            slot = get_slot();
+            if (_phrase->Start())
+                start_voice(slot, _phrase, 1.0f);
+            _phrase_played = true;
+            break;
+
+        case SESSION_GAIN:
+            _limiter->SetGain(evt->clip / 256.0f * _headroom);
+            break;
+    }
+}
+
+// returns the number of events rendered, -1 when the log or the output can not be opened.
+// without wav_fname only the hash and the length of the output are kept
+int SessionRender::render(fs::FS &fs, const char *log_path, const char *wav_fname) {
+    File log = fs.open(log_path);
+    if (!log)
+        return -1;
+
+    WAVFileWriter writer(wav_fname ? wav_fname : "", kRATE);
+    if (wav_fname)
+        writer.start();
+
+    _sink    = new AudioOutputWAVFile(wav_fname ? &writer : NULL);
+    _limiter = new AudioOutputLimiter(_sink);
+    _mixer   = new AudioOutputMixer(32, _limiter);
+    for (int i = 0; i < kMAX_MIX; i++) {
+        _gen[i]     = new AudioGeneratorWAV();
+        _src[i]     = new AudioFileSourceSD();
+        _pcm[i]     = new AudioFileSourcePCM(_src[i]);
+        _stub[i]    = _mixer->NewInput();
+        _playing[i] = NULL;
+    }
+    _phrase_src[0] = new AudioFileSourceSD();
+    _phrase_src[1] = new AudioFileSourceSD();
+    _phrase        = new AudioFileSourcePhrase(_phrase_src[0], _phrase_src[1]);
+    _phrase_played = false;
+
+    _limiter->SetRate(kRATE);
+    _limiter->SetGain(_headroom);
+    _limiter->begin();
+
+    session_event_t evt;
+    uint32_t        frame   = 0;
+    uint32_t        last_ts = 0;
+    int             cnt     = 0;
+
+    while (log.read((uint8_t *)&evt, sizeof(evt)) == sizeof(evt)) {
+        uint32_t gap = 0;
+
+        // a new boot restarts the clock, keep one full gap as a separator
+        if (evt.type == SESSION_BOOT)
+            gap = (cnt > 0) ? _max_gap_ms : 0;
+        else
+            gap = min(evt.ts - last_ts, (uint32_t)_max_gap_ms);
+
+        frame  += gap * kRATE / 1000;
+        last_ts = evt.ts;
+        advance(frame);
+        handle(&evt);
+        cnt++;
+    }
+    log.close();
+
+    // let the last words finish and push the limiter lookahead out
+    ((AudioOutputWAVFile *)_sink)->SetLimit(UINT32_MAX);
+    while (is_running())
+        service();
+    advance(((AudioOutputWAVFile *)_sink)->GetFrames() + AudioOutputLimiter::kLOOKAHEAD);
+    _sink->flush();
+    writer.stop();
+    _hash   = ((AudioOutputWAVFile *)_sink)->GetHash();
+    _frames = ((AudioOutputWAVFile *)_sink)->GetFrames();
+
+    for (int i = 0; i < kMAX_MIX; i++) {
+        stop_voice(i);
+        delete _stub[i];
+        delete _gen[i];
+        delete _pcm[i];
+        delete _src[i];
+    }
+    delete _phrase;
+    delete _phrase_src[0];
+    delete _phrase_src[1];
+    delete _mixer;
+    delete _limiter;
+    delete _sink;
+
+    return cnt;
+}
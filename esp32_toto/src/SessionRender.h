@@ -0,0 +1,74 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SESSION_RENDER_H_
+#define _SESSION_RENDER_H_
+#include <Arduino.h>
+#include "AudioFileSourcePCM.h"
+#include "AudioFileSourcePhrase.h"
+#include "AudioFileSourceSD.h"
+#include "AudioGeneratorWAV.h"
+#include "AudioOutputLimiter.h"
+#include "AudioOutputMixer.h"
+#include "ClipLibrary.h"
+#include "SessionLog.h"
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// replays a session log through the same generators, mixer and limiter as the live
+// output and writes the result into one mono WAV. Idle time between presses is cut
+// down to max_gap_ms, so a session can be reviewed without listening to the pauses
+class SessionRender {
+public:
+    enum : int { kMAX_MIX = 3,
+                 kRATE = 22050 };
+
+    SessionRender(ClipLibrary &library, float headroom, int max_gap_ms);
+
+    int      render(fs::FS &fs, const char *log_path, const char *wav_fname);
+    uint32_t get_hash()             { return _hash; }      // of the last render
+    uint32_t get_frames()           { return _frames; }
+
+private:
+    int  get_slot();
+    void stop_voice(int slot);
+    void start_voice(int slot, AudioFileSource *src, float gain);
+    void service();
+    bool is_running();
+    void advance(uint32_t frame);
+    void handle(session_event_t *evt);
+
+    ClipLibrary           &_library;
+    float                  _headroom;
+    int                    _max_gap_ms;
+
+    AudioOutput           *_sink;
+    AudioOutputLimiter    *_limiter;
+    AudioOutputMixer      *_mixer;
+    AudioGeneratorWAV     *_gen[kMAX_MIX];
+    AudioFileSourceSD     *_src[kMAX_MIX];
+    AudioFileSourcePCM    *_pcm[kMAX_MIX];
+    AudioOutputMixerStub  *_stub[kMAX_MIX];
+    AudioFileSource       *_playing[kMAX_MIX];
+    AudioFileSourceSD     *_phrase_src[2];
+    AudioFileSourcePhrase *_phrase;
+    bool                   _phrase_played;
+    uint32_t               _hash;
+    uint32_t               _frames;
+};
+
+#endif
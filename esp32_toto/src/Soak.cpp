@@ -0,0 +1,141 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "Soak.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// share of each event in 1/16, key presses dominate like in real use
+static const uint8_t kWEIGHTS[SOAK_MAX] = { 0, 10, 2, 2, 1, 1 };
+
+static const char *kEVENT_NAMES[SOAK_MAX] = { "none", "key", "play", "compose", "gain", "rec" };
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+Soak::Soak(Print &out, int min_gap_ms, int max_gap_ms, int report_ms) : _out(out) {
+    _min_gap_ms = min_gap_ms;
+    _max_gap_ms = max_gap_ms;
+    _report_ms  = report_ms;
+    _running    = false;
+}
+
+// xorshift32, the same seed replays the same run
+uint32_t Soak::rand() {
+    _rnd ^= _rnd << 13;
+    _rnd ^= _rnd >> 17;
+    _rnd ^= _rnd << 5;
+    return _rnd;
+}
+
+void Soak::start(uint32_t seed, int max_key) {
+    _seed     = seed ? seed : 1;
+    _rnd      = _seed;
+    _max_key  = max(max_key, 1);
+    _start_ts = millis();
+    _next_ts  = _start_ts;
+    _report_ts = _start_ts;
+    memset(_events, 0, sizeof(_events));
+
+    _passes         = 0;
+    _worst_loop_us  = 0;
+    _max_open       = 0;
+    _max_voices     = 0;
+    _stuck          = 0;
+    _idle_heap0     = 0;
+    _idle_heap      = 0;
+    _idle_heap_min  = 0;
+    _idle_block_min = 0;
+    _running        = true;
+}
+
+void Soak::stop() {
+    if (_running)
+        report();
+    _running = false;
+}
+
+// the next event once its time has come, SOAK_NONE in between
+int Soak::poll(int *arg) {
+    uint32_t now = millis();
+
+    if (!_running || (int32_t)(now - _next_ts) < 0)
+        return SOAK_NONE;
+
+    _next_ts = now + _min_gap_ms + rand() % (_max_gap_ms - _min_gap_ms + 1);
+
+    int pick = rand() % 16;
+    int evt  = SOAK_KEY;
+    for (int i = SOAK_KEY; i < SOAK_MAX; i++) {
+        if (pick < kWEIGHTS[i]) {
+            evt = i;
+            break;
+        }
+        pick -= kWEIGHTS[i];
+    }
+
+    *arg = (evt == SOAK_KEY) ? rand() % _max_key : rand() & 1;
+    _events[evt]++;
+    return evt;
+}
+
+void Soak::sample(soak_sample_t *s) {
+    if (!_running)
+        return;
+
+    _passes++;
+    _worst_loop_us = max(_worst_loop_us, s->loop_us);
+    _max_open      = max(_max_open, s->open_files);
+    _max_voices    = max(_max_voices, s->voices);
+    if (s->stuck_voices)
+        _stuck++;
+
+    // only idle passes are compared, a recording or a phrase in flight holds memory
+    if (s->idle) {
+        uint32_t heap  = ESP.getFreeHeap();
+        uint32_t block = ESP.getMaxAllocHeap();
+
+        if (!_idle_heap0) {
+            _idle_heap0     = heap;
+            _idle_heap_min  = heap;
+            _idle_block_min = block;
+        }
+        _idle_heap      = heap;
+        _idle_heap_min  = min(_idle_heap_min, heap);
+        _idle_block_min = min(_idle_block_min, block);
+    }
+
+    if (IS_ELAPSED(millis(), _report_ts, (uint32_t)_report_ms)) {
+        _report_ts = millis();
+        report();
+    }
+}
+
+// one JSON line, a drift in idle_heap or a stuck count above 0 is a leak
+void Soak::report() {
+    _out.printf("SOAK {\"seed\":%u,\"elapsed_s\":%u,\"passes\":%u,\"events\":{", (unsigned)_seed,
+                (unsigned)((millis() - _start_ts) / 1000), (unsigned)_passes);
+    for (int i = SOAK_KEY; i < SOAK_MAX; i++)
+        _out.printf("%s\"%s\":%u", (i > SOAK_KEY) ? "," : "", kEVENT_NAMES[i], (unsigned)_events[i]);
+    _out.printf("},\"worst_loop_us\":%u,\"max_open_files\":%u,\"max_voices\":%u,\"stuck_passes\":%u,",
+                (unsigned)_worst_loop_us, _max_open, _max_voices, (unsigned)_stuck);
+    _out.printf("\"idle_heap_start\":%u,\"idle_heap\":%u,\"idle_heap_min\":%u,\"idle_block_min\":%u,"
+                "\"heap_low_water\":%u}\n",
+                (unsigned)_idle_heap0, (unsigned)_idle_heap, (unsigned)_idle_heap_min, (unsigned)_idle_block_min,
+                (unsigned)ESP.getMinFreeHeap());
+}
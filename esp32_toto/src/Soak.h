@@ -0,0 +1,94 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SOAK_H_
+#define _SOAK_H_
+#include <Arduino.h>
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+enum : uint8_t {
+    SOAK_NONE = 0,
+    SOAK_KEY,               // arg : key
+    SOAK_PLAY,              // next clip of the library, 'p'
+    SOAK_COMPOSE,           // 'c', every other one plays the sentence
+    SOAK_GAIN,              // arg : 0 down, 1 up
+    SOAK_REC,               // 'r', the next SOAK_REC ends it
+    SOAK_MAX
+};
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+// what the loop owns and the soak can not see for itself, sampled once per pass
+typedef struct _soak_sample {
+    uint32_t    loop_us;            // the whole loop() pass
+    uint8_t     open_files;
+    uint8_t     voices;
+    uint8_t     stuck_voices;       // running for longer than any clip can
+    bool        idle;               // nothing playing or recording, heap is comparable
+} soak_sample_t;
+
+/*
+*****************************************************************************************
+* Class
+*****************************************************************************************
+*/
+// random but repeatable (seeded) presses, sentences, gain changes and recordings fed into
+// the loop for as long as it runs, with a periodic JSON report of what drifts : heap at
+// idle against the first idle pass, open files, voices that never end, worst loop time
+class Soak {
+public:
+    Soak(Print &out, int min_gap_ms, int max_gap_ms, int report_ms);
+
+    void start(uint32_t seed, int max_key);
+    void stop();
+    bool is_running()               { return _running; }
+    int  poll(int *arg);
+    void sample(soak_sample_t *s);
+    void report();
+
+private:
+    uint32_t    rand();
+
+    Print      &_out;
+    int         _min_gap_ms;
+    int         _max_gap_ms;
+    int         _report_ms;
+    bool        _running;
+    uint32_t    _seed;
+    uint32_t    _rnd;
+    int         _max_key;
+    uint32_t    _start_ts;
+    uint32_t    _next_ts;
+    uint32_t    _report_ts;
+    uint32_t    _events[SOAK_MAX];
+
+    uint32_t    _passes;
+    uint32_t    _worst_loop_us;
+    uint8_t     _max_open;
+    uint8_t     _max_voices;
+    uint32_t    _stuck;
+    uint32_t    _idle_heap0;        // free internal heap at the first idle pass
+    uint32_t    _idle_heap;
+    uint32_t    _idle_heap_min;
+    uint32_t    _idle_block_min;
+};
+
+#endif
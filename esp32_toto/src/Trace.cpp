@@ -0,0 +1,164 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#include "Trace.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+static const int  kTRACE_SIZE  = 512;           // power of 2, 10KB
+static const int  kDRAIN_BATCH = 32;
+
+static const char *kTRACE_NAMES[TR_MAX] = {
+    "none",
+    "key",
+    "play_start",
+    "play_stop",
+    "phrase_start",
+    "rec_block",
+    "vad_start",
+    "vad_end",
+    "exp_service",
+    "exp_queue_full",
+    "cache_hit",
+    "cache_miss",
+    "cache_fill",
+    "key_up",
+};
+
+/*
+*****************************************************************************************
+* VARIABLES
+*****************************************************************************************
+*/
+static trace_rec_t   _ring[kTRACE_SIZE];
+// both start one lap ahead so the zeroed seq of an unused record never matches
+static uint32_t      _head = kTRACE_SIZE;
+static uint32_t      _tail = kTRACE_SIZE;
+static uint32_t      _lost;
+static volatile bool _reading;
+
+static Print        *_drain_out;
+static int           _drain_ms;
+static volatile bool _drain_on;
+static TaskHandle_t  _drain_task;
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+// one atomic add claims the slot, seq is published last so the reader can tell a record
+// still being written (or overwritten by a later lap) from a finished one
+void IRAM_ATTR trace_add(uint16_t id, int32_t a, int32_t b) {
+    uint32_t     idx = __atomic_fetch_add(&_head, 1, __ATOMIC_RELAXED);
+    trace_rec_t *rec = &_ring[idx & (kTRACE_SIZE - 1)];
+
+    __atomic_store_n(&rec->seq, ~idx, __ATOMIC_RELAXED);
+    rec->ts   = micros();
+    rec->id   = id;
+    rec->core = xPortGetCoreID();
+    rec->a    = a;
+    rec->b    = b;
+    __atomic_store_n(&rec->seq, idx, __ATOMIC_RELEASE);
+}
+
+// copies out the record at _tail, 1 : got one, 0 : not finished yet, -1 : overwritten
+static int trace_get(trace_rec_t *rec) {
+    trace_rec_t *src = &_ring[_tail & (kTRACE_SIZE - 1)];
+
+    if (__atomic_load_n(&src->seq, __ATOMIC_ACQUIRE) != _tail)
+        return ((int32_t)(__atomic_load_n(&_head, __ATOMIC_RELAXED) - _tail) > kTRACE_SIZE) ? -1 : 0;
+
+    *rec = *src;
+    // a writer may have lapped us while copying
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == _tail) ? 1 : -1;
+}
+
+static void trace_print(Print &out, trace_rec_t *rec) {
+    const char *name = (rec->id < TR_MAX) ? kTRACE_NAMES[rec->id] : "?";
+
+    out.printf("%10u %d %-14s %6d %6d\n", (unsigned)rec->ts, rec->core, name, (int)rec->a, (int)rec->b);
+}
+
+// decodes up to max_cnt records in order, returns the number printed
+int trace_dump(Print &out, int max_cnt) {
+    trace_rec_t rec;
+    int         cnt = 0;
+
+    // single reader, the drain task and the console can both ask
+    if (__atomic_exchange_n(&_reading, true, __ATOMIC_ACQUIRE))
+        return 0;
+
+    while (cnt < max_cnt) {
+        uint32_t head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+
+        // fell more than a lap behind, jump to the oldest record still in the ring
+        if ((int32_t)(head - _tail) > kTRACE_SIZE) {
+            _lost += head - kTRACE_SIZE - _tail;
+            _tail  = head - kTRACE_SIZE;
+        }
+        if (_tail == head)
+            break;
+
+        int ret = trace_get(&rec);
+        if (ret == 0)
+            break;
+        if (ret < 0) {
+            _lost++;
+            _tail++;
+            continue;
+        }
+        _tail++;
+        trace_print(out, &rec);
+        cnt++;
+    }
+    __atomic_store_n(&_reading, false, __ATOMIC_RELEASE);
+
+    return cnt;
+}
+
+uint32_t trace_get_lost() {
+    return _lost;
+}
+
+static void trace_drain_task(void *param) {
+    while (true) {
+        if (_drain_on) {
+            while (trace_dump(*_drain_out, kDRAIN_BATCH) == kDRAIN_BATCH)
+                vTaskDelay(1);
+        }
+        vTaskDelay(pdMS_TO_TICKS(_drain_ms));
+    }
+}
+
+// lowest priority on the core the audio loop does not run on, it only gets the idle time
+bool trace_begin(Print *out, int period_ms) {
+    if (_drain_task)
+        return true;
+
+    _drain_out = out;
+    _drain_ms  = period_ms;
+    return xTaskCreatePinnedToCore(trace_drain_task, "trace", 3072, NULL, tskIDLE_PRIORITY, &_drain_task, 0) == pdPASS;
+}
+
+void trace_set_drain(bool on) {
+    _drain_on = on;
+}
+
+bool trace_get_drain() {
+    return _drain_on;
+}
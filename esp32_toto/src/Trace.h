@@ -0,0 +1,77 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <Arduino.h>
+#include "utils.h"
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// keep in sync with the name table in Trace.cpp
+enum : uint16_t {
+    TR_NONE = 0,
+    TR_KEY,                 // a : key,         b : clip id, -1 when no clip
+    TR_PLAY_START,          // a : slot,        b : clip id
+    TR_PLAY_STOP,           // a : slot
+    TR_PHRASE_START,        // a : slot,        b : words
+    TR_REC_BLOCK,           // a : bytes,       b : vad state
+    TR_VAD_START,
+    TR_VAD_END,
+    TR_EXP_SERVICE,         // a : events,      b : rounds
+    TR_EXP_QUEUE_FULL,      // a : device,      b : key
+    TR_CACHE_HIT,           // a : hits
+    TR_CACHE_MISS,          // a : misses
+    TR_CACHE_FILL,          // a : entry,       b : us
+    TR_KEY_UP,              // a : key,         b : slot released, -1 when none
+    TR_MAX
+};
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+typedef struct _trace_rec {
+    uint32_t    seq;                // slot number, written last, tells a finished record
+    uint32_t    ts;                 // micros()
+    uint16_t    id;
+    uint16_t    core;
+    int32_t     a;
+    int32_t     b;
+} trace_rec_t;
+
+#if __TRACE__
+#define TRACE(id, a, b)         trace_add(id, a, b)
+#else
+#define TRACE(id, a, b)
+#endif
+
+/*
+*****************************************************************************************
+* FUNCTIONS
+*****************************************************************************************
+*/
+// fixed size flight recorder : writers never wait, the oldest records are overwritten.
+// safe from any task on either core and from ISRs, there is a single reader
+void     trace_add(uint16_t id, int32_t a, int32_t b);
+int      trace_dump(Print &out, int max_cnt);
+uint32_t trace_get_lost();
+bool     trace_begin(Print *out, int period_ms);
+void     trace_set_drain(bool on);
+bool     trace_get_drain();
+
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <Arduino.h>
+#include "MemAlloc.h"
+#include "WAVFileWriter.h"
+
+/*
+ Streaming voice activity detector for the recorder.
+ Every I2S block is classified with an integer energy + zero-crossing test. Blocks are
+ held in a small ring until speech is confirmed so the onset is kept (pre-roll), and
+ trailing silence is held back the same way so only a short tail reaches the file.
+*/
+class VoiceDetector {
+public:
+    enum : int { VAD_SILENCE = 0,   // no speech yet, nothing written
+                 VAD_START,         // speech onset, pre-roll + this block written
+                 VAD_SPEECH,        // inside speech (or short pause)
+                 VAD_END };         // trailing silence elapsed, caller should stop
+
+    VoiceDetector(int block_samples, int pre_roll_blocks, int hangover_blocks, int tail_blocks = 2) {
+        _block_samples = block_samples;
+        _pre_roll      = pre_roll_blocks;
+        _hangover      = hangover_blocks;
+        _ring_blocks   = max(pre_roll_blocks, hangover_blocks);
+        _tail          = tail_blocks;
+        _ring          = (int16_t *)mem_alloc(sizeof(int16_t) * _block_samples * _ring_blocks, MEM_LARGE, "vad");
+        _ring_cnt      = (uint16_t *)mem_alloc(sizeof(uint16_t) * _ring_blocks, MEM_FAST, "vad_cnt");
+
+        // energy threshold in (sample^2 >> 15) units, ~ -50 dBFS
+        _min_energy    = 4;
+        _max_zcr       = (_block_samples * 3) / 8;    // noisy hiss crosses zero almost every other sample
+        reset();
+    }
+
+    ~VoiceDetector() {
+        mem_free(_ring);
+        mem_free(_ring_cnt);
+    }
+
+    void reset() {
+        _state       = VAD_SILENCE;
+        _ring_head   = 0;
+        _ring_used   = 0;
+        _speech_run  = 0;
+        _silence_run = 0;
+        _noise_floor = _min_energy;
+    }
+
+    int get_state() {
+        return _state;
+    }
+
+    // classify one block and forward what should be kept to writer
+    int process(int16_t *samples, int count, WAVFileWriter *writer) {
+        bool speech;
+
+        if (count > _block_samples)
+            count = _block_samples;
+        speech = is_speech(samples, count);
+
+        switch (_state) {
+            case VAD_SILENCE:
+                if (speech && ++_speech_run >= 2) {
+                    flush_ring(writer, _ring_used);
+                    writer->write(samples, count);
+                    _silence_run = 0;
+                    _state = VAD_START;
+                } else {
+                    if (!speech)
+                        _speech_run = 0;
+                    push_ring(samples, count, NULL);
+                }
+                break;
+
+            case VAD_START:
+            case VAD_SPEECH:
+                _state = VAD_SPEECH;
+                if (speech) {
+                    // pause was part of the utterance, keep it
+                    flush_ring(writer, _ring_used);
+                    writer->write(samples, count);
+                    _silence_run = 0;
+                } else if (++_silence_run >= _hangover) {
+                    flush_ring(writer, min(_tail, _ring_used));
+                    _ring_used = 0;
+                    _state = VAD_END;
+                } else {
+                    push_ring(samples, count, writer);
+                }
+                break;
+
+            case VAD_END:
+                break;
+        }
+        return _state;
+    }
+
+private:
+    bool is_speech(int16_t *samples, int count) {
+        int32_t  sum = 0;
+        uint32_t pwr = 0;
+        uint16_t zcr = 0;
+        int16_t  prev;
+        uint32_t energy;
+        int32_t  mean;
+
+        // an empty read from I2S says nothing, the noise floor stays where it is
+        if (count <= 0)
+            return false;
+
+        prev = samples[0];
+        for (int i = 0; i < count; i++) {
+            int32_t s = samples[i];
+
+            sum += s;
+            pwr += (uint32_t)(s * s) >> 15;
+            zcr += ((s ^ prev) < 0);
+            prev = s;
+        }
+
+        // remove mic DC offset : E[x^2] - E[x]^2
+        mean   = sum / count;
+        energy = pwr / count;
+        mean   = (mean * mean) >> 15;
+        energy = (energy > (uint32_t)mean) ? (energy - mean) : 0;
+
+        // speech has to stand 4x (6dB) above the tracked background noise
+        uint32_t thr = max(_min_energy, _noise_floor << 2);
+        bool     speech = (energy > thr) && (zcr < _max_zcr || energy > (thr << 2));
+
+        if (!speech) {
+            // slow first order tracker, rises ~1/16 per block and drops immediately
+            if (energy < _noise_floor)
+                _noise_floor = energy;
+            else
+                _noise_floor += (energy - _noise_floor + 15) >> 4;
+            if (_noise_floor < _min_energy)
+                _noise_floor = _min_energy;
+        }
+        return speech;
+    }
+
+    // ring holds the most recent blocks : up to pre-roll while silent, up to hangover while
+    // in a pause. On overflow the oldest block is dropped (silent) or written out (speech)
+    void push_ring(int16_t *samples, int count, WAVFileWriter *writer) {
+        int cap = writer ? _ring_blocks : _pre_roll;
+
+        if (cap == 0) {
+            if (writer)
+                writer->write(samples, count);
+            return;
+        }
+
+        if (_ring_used >= cap) {
+            if (writer) {
+                flush_ring(writer, 1);
+            } else {
+                // still silent, drop the oldest block
+                _ring_head = (_ring_head + 1) % _ring_blocks;
+                _ring_used--;
+            }
+        }
+
+        int slot = (_ring_head + _ring_used) % _ring_blocks;
+        memcpy(&_ring[slot * _block_samples], samples, sizeof(int16_t) * count);
+        _ring_cnt[slot] = count;
+        _ring_used++;
+    }
+
+    void flush_ring(WAVFileWriter *writer, int blocks) {
+        while (blocks-- > 0 && _ring_used > 0) {
+            writer->write(&_ring[_ring_head * _block_samples], _ring_cnt[_ring_head]);
+            _ring_head = (_ring_head + 1) % _ring_blocks;
+            _ring_used--;
+        }
+    }
+
+    int       _state;
+    int       _block_samples;
+    int       _ring_blocks;
+    int       _pre_roll;
+    int       _hangover;
+    int       _tail;
+    int16_t  *_ring;
+    uint16_t *_ring_cnt;
+    int       _ring_head;
+    int       _ring_used;
+    int       _speech_run;
+    int       _silence_run;
+    uint32_t  _min_energy;
+    uint32_t  _noise_floor;
+    uint16_t  _max_zcr;
+};
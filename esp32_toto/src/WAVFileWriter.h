@@ -9,17 +9,36 @@ private:
     char    *_fname;
     int     _file_size;
     FILE    *_fp;
+    char    *_io_buf;
+    int     _io_size;
     wav_header_t _header;
 
 public:
     WAVFileWriter(const char *fname, int sample_rate) {
         _fname = (char*)fname;
+        _fp = NULL;
+        _io_buf = NULL;
+        _io_size = 0;
         _header.sample_rate = sample_rate;
     }
 
+    // stdio buffer owned by the caller, kept over recordings instead of one per fopen
+    void set_buffer(char *buf, int size) {
+        _io_buf = buf;
+        _io_size = size;
+    }
+
+    // the same writer for the next recording, fname has to stay valid until start() returns
+    void start(const char *fname) {
+        _fname = (char*)fname;
+        start();
+    }
+
     void start() {
         _fp = fopen(_fname, "wb");
         if (_fp) {
+            if (_io_buf)
+                setvbuf(_fp, _io_buf, _IOFBF, _io_size);
             // write out the header - we'll fill in some of the blanks later
             fwrite(&_header, sizeof(wav_header_t), 1, _fp);
             _file_size = sizeof(wav_header_t);
@@ -42,6 +61,7 @@ public:
             fseek(_fp, 0, SEEK_SET);
             fwrite(&_header, sizeof(wav_header_t), 1, _fp);
             fclose(_fp);
+            _fp = NULL;
         }
     }
 };
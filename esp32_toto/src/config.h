@@ -7,6 +7,8 @@
 *****************************************************************************************
 */
 #define __DEBUG__           1
+#define __TRACE__           1           // binary trace buffer, see Trace.h
+#define __METRICS__         1           // counters and histograms, see Metrics.h
 
 
 /*
@@ -18,6 +20,10 @@
 #define WIFI_PASSWORD       "cafebabe12"
 #define CALIBRATION_FILE    "/touch.cal"
 
+#define EXP_I2C_ADDR        0x21        // first expander, the others follow on +1, +2 ..
+#define EXP_MAX_DEVICES     3
+#define EXP_DEBOUNCE_MS     10
+
 
 /*
 *****************************************************************************************
@@ -60,6 +66,11 @@
 #define PIN_TOUCH_6         12
 #define PIN_TOUCH_7         13
 
+// ATmega328 gpio expander (arduino_gpio_exander)
+#define PIN_EXP_SDA         21
+#define PIN_EXP_SCL         22
+#define PIN_EXP_INT         35          // shared open drain request, external pull-up
+
 /*
 *****************************************************************************************
 * MACROS & STRUCTURES
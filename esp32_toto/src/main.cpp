@@ -2,19 +2,38 @@
 #include <HTTPClient.h>
 #include <WiFi.h>
 
+#include "AudioFileSourceClip.h"
+#include "AudioFileSourcePCM.h"
+#include "AudioFileSourcePhrase.h"
 #include "AudioFileSourceSD.h"
-#include "AudioGeneratorMOD.h"
+#include "AudioGeneratorTracker.h"
 #include "AudioGeneratorWAV.h"
 #include "AudioInputI2S.h"
 #include "AudioOutputI2S.h"
 #include "AudioOutputMixer.h"
+#include "AudioOutputDucker.h"
+#include "AudioOutputLimiter.h"
+#include "ClipCache.h"
+#include "ClipLibrary.h"
 #include "FS.h"
 #include "SD.h"
+#include "SessionLog.h"
+#include "SessionRender.h"
+#include "SerialLink.h"
+#include "Soak.h"
 #include "SPI.h"
 #include "SPIFFS.h"
+#include "Trace.h"
+#include "Wire.h"
+#include "GpioExpander.h"
+#include "Golden.h"
+#include "MemAlloc.h"
+#include "Metrics.h"
 #include "WAVFileWriter.h"
+#include "VoiceDetector.h"
 #include "utils.h"
 #include "DeepSleep.h"
+#include "enigma.h"
 
 /*
 *****************************************************************************************
@@ -31,6 +50,44 @@ enum : int { ST_IDLE = 0,
              ST_RECORDING = 2 };
 
 static const int kMAX_MIX = 3;
+static const float kMIX_HEADROOM = 2.0f;    // voices are mixed at -6dB, the limiter makes it up
+static const int kMAX_SUSTAIN_MS = 30000;   // a held key loops no longer, a lost key-up ends there
+static const int kPHRASE_GAP_MS = 150;      // optional pause between the words of a sentence
+static const int kPREFETCH_MS = 250;        // head of a clip kept in RAM, covers the SD open of the rest
+static const int kSD_MAX_FILES = 16;        // prefetched clips stay open
+static const int kREC_RATE = 22050;
+static const int kREC_IO_BUF = 4096;        // stdio buffer of the recording, whole sectors per write
+static const int kSERIAL_RX_BUF = 8192;     // clip uploads keep streaming while a block goes to the card
+static const float kMUSIC_GAIN = 0.4f;      // background music sits under the words
+static const int kMUSIC_BENCH_MS = 10000;   // song time rendered by the 'u' benchmark
+static const int kLIMITER_BENCH_FRAMES = 22050 * 5;
+static const float kDUCK_DEPTH = 0.25f;     // music -12dB while a word plays
+static const int kDUCK_ATTACK_MS = 40;
+static const int kDUCK_RELEASE_MS = 600;    // comes back after the last word, not between two
+
+// session log, written to the card in batches while nothing plays
+static const int kSESSION_FLUSH_BATCH   = 32;
+static const int kSESSION_FLUSH_IDLE_MS = 5000;
+static const int kRENDER_MAX_GAP_MS     = 2000; // pauses between presses in the rendered session
+
+static const int kTRACE_DRAIN_MS = 200;     // background trace output, 'T' turns it on
+
+// soak mode, 'S' starts and stops it. keys without a clip are pressed as well
+static const int kSOAK_MAX_KEY     = 50;
+static const int kSOAK_MIN_GAP_MS  = 20;
+static const int kSOAK_MAX_GAP_MS  = 500;
+static const int kSOAK_REPORT_MS   = 60000;
+static const int kSOAK_STUCK_MS    = 120000;    // longer than any clip or sentence plays
+static const uint32_t kSOAK_SEED   = 0;         // 0 : a new one each run, set it to replay one
+
+// AudioOutputI2S default of 8 DMA buffers x 128 frames at the 22kHz of the library, a play
+// pass starting later than that has let the DMA run dry
+static const uint32_t kI2S_DMA_US = 8 * 128 * 1000000ULL / 22050;
+
+// recorder voice activity detection, in 40ms blocks
+static const int kVAD_PRE_ROLL_BLKS = 8;    // 320ms kept before the detected onset
+static const int kVAD_HANGOVER_BLKS = 25;   // 1s of silence ends the recording
+static const int kVAD_TAIL_BLKS     = 3;    // 120ms of that silence is kept
 
 static const uint8_t _tbl_touch_pins[] = {
     PIN_TOUCH_1,
@@ -51,66 +108,42 @@ static SPIClass _spi_sd(VSPI);
 
 static AudioOutputI2S *_i2s_out = new AudioOutputI2S();
 static AudioGenerator *_gen[kMAX_MIX];
-static AudioFileSource *_file_src[kMAX_MIX];
-static AudioOutputMixer *_mixer = new AudioOutputMixer(32, _i2s_out);
+static AudioFileSourcePCM *_file_src[kMAX_MIX];
+static AudioOutputLimiter *_limiter = new AudioOutputLimiter(_i2s_out);
+static AudioOutputMixer *_mixer = new AudioOutputMixer(32, _limiter);
 static AudioOutputMixerStub *_stub[kMAX_MIX];
+static AudioGeneratorTracker *_music = new AudioGeneratorTracker(enigma_mod, sizeof(enigma_mod));
+static AudioOutputMixerStub *_music_stub;
+static AudioOutputDucker *_ducker;
 
 static AudioInputI2S *_i2s_in = new AudioInputI2S();
 static uint16_t _rec_buf_size = 0;
 static int16_t *_rec_buf = NULL;
+static char *_rec_io_buf = NULL;
 static WAVFileWriter *_wav_writer;
+static VoiceDetector *_vad;
+
+static GpioExpander _expander(EXP_I2C_ADDR, EXP_MAX_DEVICES, PIN_EXP_INT);
+static ClipLibrary _library(SD, "/words", "/words.idx");
+static ClipCache _cache(SD, kPREFETCH_MS);
+static SessionLog _session(SD, "/session.log");
+static SerialLink _link(Serial, SD, "/words/upload.tmp");
+static Soak _soak(Serial, kSOAK_MIN_GAP_MS, kSOAK_MAX_GAP_MS, kSOAK_REPORT_MS);
+static int _play_idx = 0;
+static AudioFileSourcePhrase *_phrase = new AudioFileSourcePhrase(new AudioFileSourceClip(SD, _cache),
+                                                                  new AudioFileSourceClip(SD, _cache));
+static bool _composing = false;
+static bool _phrase_gap = false;
 
 static int _status = ST_IDLE;
-static File _dir;
 static float _gain = 1.0f;
 static uint32_t _dw_wake_btn = 0;
 static uint32_t _dw_old_btn = 0;
-static char *_file_list[20];
-static uint8_t _file_cnt = 0;
-
-
-/*
-*****************************************************************************************
-*
-*****************************************************************************************
-*/
-void listDir(fs::FS &fs, const char *dirname, uint8_t levels) {
-    LOG("Listing directory: %s\n", dirname);
-
-    File root = fs.open(dirname);
-
-    if (!root) {
-        LOG("Failed to open directory\n");
-        return;
-    }
-    if (!root.isDirectory()) {
-        LOG("Not a directory\n");
-        return;
-    }
-
-    File file = root.openNextFile();
-    while (file) {
-        if (file.isDirectory()) {
-            LOG("[%-30s] %12s", file.name(), " ");
-            time_t t = file.getLastWrite();
-            struct tm *tmstruct = localtime(&t);
-            LOG(" %d-%02d-%02d %02d:%02d:%02d\n", (tmstruct->tm_year) + 1900, (tmstruct->tm_mon) + 1, tmstruct->tm_mday, tmstruct->tm_hour, tmstruct->tm_min, tmstruct->tm_sec);
-            if (levels) {
-                listDir(fs, file.name(), levels - 1);
-            }
-        } else {
-            if (_file_cnt < 20) {
-                _file_list[_file_cnt] = (char*)malloc(strlen(file.name() + 1));
-                strcpy(_file_list[_file_cnt++], file.name());
-            }
-            LOG(" %-30s  %12lu", file.name(), file.size());
-            time_t t = file.getLastWrite();
-            struct tm *tmstruct = localtime(&t);
-            LOG(" %d-%02d-%02d %02d:%02d:%02d\n", (tmstruct->tm_year) + 1900, (tmstruct->tm_mon) + 1, tmstruct->tm_mday, tmstruct->tm_hour, tmstruct->tm_min, tmstruct->tm_sec);
-        }
-        file = root.openNextFile();
-    }
-}
+static uint32_t _play_ts = 0;
+static uint32_t _voice_ts[kMAX_MIX];
+static int _voice_key[kMAX_MIX];        // key holding the voice, -1 when it plays through
+static int _soak_key = -1;
+static bool _duck = true;
 
 
 /*
@@ -128,56 +161,120 @@ int get_free_slot() {
     return 0;
 }
 
-bool setup_play(String fname) {
-    // if (fname.endsWith(".wav")) {
-    //     _gen = new AudioGeneratorWAV();
-    // } else if (fname.endsWith(".mod")) {
-    //     AudioGeneratorMOD *mod = new AudioGeneratorMOD();
-    //     mod->SetBufferSize(20 * 1024);
-    //     _gen = mod;
-    // }
+// voices and the recorder are a fixed pool made once at boot : playing and recording only
+// rebind them, so hours of key presses do not cut up the internal heap
+void alloc_pools() {
+    uint32_t heap  = ESP.getFreeHeap();
+    uint32_t block = ESP.getMaxAllocHeap();
 
-    int slot = get_free_slot();
+    for (int i = 0; i < kMAX_MIX; i++) {
+        _gen[i]       = new AudioGeneratorWAV();
+        _file_src[i]  = new AudioFileSourcePCM(new AudioFileSourceClip(SD, _cache));
+        // a stopped generator stops its mixer input, the mix skips it until the next begin
+        _stub[i]      = _mixer->NewInput();
+        _voice_key[i] = -1;
+    }
+    // music has an input of its own, word voices never steal it
+    _music_stub = _mixer->NewInput();
+    _ducker     = new AudioOutputDucker(_music_stub);
+    _ducker->SetDuck(kDUCK_DEPTH, kDUCK_ATTACK_MS, kDUCK_RELEASE_MS);
+
+    _rec_buf_size = kREC_RATE / 25;     // 40ms buffer
+    _rec_buf      = (int16_t *)mem_alloc(sizeof(int16_t) * _rec_buf_size, MEM_FAST, "rec");
+    _rec_io_buf   = (char *)mem_alloc(kREC_IO_BUF, MEM_DMA, "rec_io");
+    _vad          = new VoiceDetector(_rec_buf_size, kVAD_PRE_ROLL_BLKS, kVAD_HANGOVER_BLKS, kVAD_TAIL_BLKS);
+    _wav_writer   = new WAVFileWriter("", kREC_RATE);
+    _wav_writer->set_buffer(_rec_io_buf, kREC_IO_BUF);
+
+    LOG("pools : heap %u -> %u, largest block %u -> %u\n", (unsigned)heap, (unsigned)ESP.getFreeHeap(),
+        (unsigned)block, (unsigned)ESP.getMaxAllocHeap());
+}
 
-    LOG("PLAYING %s  slot:%d\n", fname.c_str(), slot);
-    _file_src[slot]->close();
-    if (_file_src[slot]->open(fname.c_str())) {
-        _stub[slot] = _mixer->NewInput();
-        _stub[slot]->SetGain(1.0);
-
-        if (_status != ST_PLAYING) {
-            LOG("I2S OUTPUT SETUP\n");
-            _i2s_out->SetPinout(PIN_I2S_BCK, PIN_I2S_WS, PIN_I2S_DOUT);
-            _i2s_out->begin();
-            _i2s_out->SetGain(_gain);
-
-            // mclk disable
-            PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0_GPIO0);
-            pinMode(PIN_SLEEP_TEST, INPUT_PULLUP);
-        }
-        _gen[slot]->begin(_file_src[slot], _stub[slot]);
+// master gain, logged so a rendered session is as loud as it was played
+static void set_gain(float gain) {
+    _gain = gain;
+    _limiter->SetGain(_gain * kMIX_HEADROOM);
+    _session.add(SESSION_GAIN, 0, (uint16_t)(max(_gain, 0.0f) * 256));
+}
+
+// I2S and the limiter, once for whatever starts playing first
+static void start_output() {
+    // the music keeps the output running while the loop is idle
+    if (_status != ST_PLAYING && !_music->isRunning()) {
+        LOG("I2S OUTPUT SETUP\n");
+        _play_ts = 0;
+        _i2s_out->SetPinout(PIN_I2S_BCK, PIN_I2S_WS, PIN_I2S_DOUT);
+        // a fresh lookahead, nothing of the last sound is left in it
+        _limiter->begin();
+        _limiter->SetGain(_gain * kMIX_HEADROOM);
 
-        return true;
+        // mclk disable
+        PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0_GPIO0);
+        pinMode(PIN_SLEEP_TEST, INPUT_PULLUP);
+    }
+}
+
+// one mixer voice on slot, gain is relative to the master gain
+static void start_voice(int slot, AudioFileSource *src, float gain) {
+    _stub[slot]->SetGain(gain / kMIX_HEADROOM);
+    start_output();
+    _gen[slot]->begin(src, _stub[slot]);
+    _voice_ts[slot]  = millis();
+    _voice_key[slot] = -1;
+}
+
+// a clip played by a key sustains its loop until the key is let go, from anywhere else
+// it plays through once. Returns the slot, -1 when the clip does not open
+int setup_play(clip_info_t *clip, int key = -1) {
+    int slot = get_free_slot();
+    String fname = _library.get_path(clip);
+    wav_info_t info;
+    bool opened;
+
+    TRACE(TR_PLAY_START, slot, ClipLibrary::get_id(clip));
+    // straight to the PCM the index knows of, the clip is parsed on open otherwise
+    if (ClipLibrary::get_wav_info(clip, &info))
+        opened = _file_src[slot]->OpenAt(fname.c_str(), &info, key >= 0);
+    else
+        opened = _file_src[slot]->open(fname.c_str());
+    if (opened) {
+        // per clip loudness normalisation, stays in the stub's fixed point gain
+        start_voice(slot, _file_src[slot], clip->gain / (float)CLIP_GAIN_UNITY);
+        _voice_key[slot] = key;
+        return slot;
     }
-    return false;
+    return -1;
+}
+
+// the whole sentence is one voice, the phrase source applies the per word gain itself
+bool setup_phrase() {
+    if (_phrase->GetCount() == 0)
+        return false;
+
+    int slot = get_free_slot();
+
+    TRACE(TR_PHRASE_START, slot, _phrase->GetCount());
+    if (!_phrase->Start())
+        return false;
+    start_voice(slot, _phrase, 1.0f);
+    _session.add(SESSION_PHRASE_PLAY, (_phrase_gap ? kPHRASE_GAP_MS : 0) / 10, 0);
+    return true;
 }
 
 void setup_rec(String fname) {
     if (_status != ST_RECORDING) {
         LOG("I2S INPUT SETUP\n");
         _i2s_in->SetPins(PIN_I2S_BCK, PIN_I2S_WS, PIN_I2S_DIN);
-        _i2s_in->SetRate(22050);
+        _i2s_in->SetRate(kREC_RATE);
         _i2s_in->SetChannels(1);
     }
 
-    if (_wav_writer)
-        delete _wav_writer;
+    // prefetched files are closed while the card is written, the new clip may replace one
+    if (_status != ST_RECORDING)
+        _cache.suspend();
 
-    _wav_writer = new WAVFileWriter(fname.c_str(), _i2s_in->GetRate());
-    _wav_writer->start();
-    _rec_buf_size = (_i2s_in->GetRate() * 1) / 25;  // 40ms buffer
-    if (!_rec_buf)
-        _rec_buf = (int16_t *)malloc(sizeof(int16_t) * _rec_buf_size);
+    _wav_writer->start(fname.c_str());
+    _vad->reset();
 
     if (_status != ST_RECORDING) {
         _i2s_in->begin();
@@ -187,6 +284,148 @@ void setup_rec(String fname) {
     }
 }
 
+void stop_rec() {
+    _wav_writer->stop();
+    _i2s_in->stop();
+    LOG("STOP RECORDING!\n");
+
+    // pick up the new clip, only the changed file is analysed
+    _library.scan();
+    _cache.resume();
+}
+
+void stop_play(int slot) {
+    if (_gen[slot]->isRunning())
+        _gen[slot]->stop();
+}
+
+// the idle-only work (benches, renders, card writes, sleep) holds loop() far longer than
+// the I2S buffers last, the music would loop its last buffer through it. 'b' starts it again
+static void stop_music() {
+    if (_music->isRunning()) {
+        LOG("music stopped\n");
+        _music->stop();
+    }
+    _limiter->stop();
+}
+
+void start_rec() {
+    for (int i = 0; i < kMAX_MIX; i++)
+        stop_play(i);
+    stop_music();
+
+    setup_rec("/sd/words/rec.wav");
+    LOG("START RECORDING!\n");
+    _status = ST_RECORDING;
+}
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+// link requests that touch the audio chain, the console ones come back as a key for loop()
+int on_link_cmd(link_cmd_t *cmd) {
+    uint8_t status = LINK_OK;
+    uint8_t slot;
+
+    switch (cmd->cmd) {
+        case LINK_CONSOLE:
+            return cmd->arg[0];
+
+        case LINK_KEY:
+            _link.reply(cmd->cmd, cmd->seq, (cmd->len == 1) ? LINK_OK : LINK_ERR_ARG);
+            return (cmd->len == 1) ? cmd->arg[0] : -1;
+
+        case LINK_PLAY:
+            if (cmd->len < 2) {
+                status = LINK_ERR_ARG;
+            } else if (_status == ST_RECORDING) {
+                status = LINK_ERR_STATE;
+            } else {
+                clip_info_t *clip = _library.find_by_id(cmd->arg[0] | (cmd->arg[1] << 8));
+                int          voice;
+
+                // an unknown id is refused before a busy voice is cut for it
+                if (!clip) {
+                    status = LINK_ERR_ARG;
+                    break;
+                }
+                voice = setup_play(clip);
+                if (voice < 0) {
+                    status = LINK_ERR_IO;
+                    break;
+                }
+                _status = ST_PLAYING;
+                slot    = voice;
+                _link.reply(cmd->cmd, cmd->seq, status, &slot, 1);
+                return -1;
+            }
+            break;
+
+        case LINK_STOP:
+            if (cmd->len < 1 || (cmd->arg[0] != LINK_ALL && cmd->arg[0] >= kMAX_MIX))
+                status = LINK_ERR_ARG;
+            for (int i = 0; status == LINK_OK && i < kMAX_MIX; i++) {
+                if (cmd->arg[0] == LINK_ALL || cmd->arg[0] == i)
+                    stop_play(i);
+            }
+            break;
+
+        case LINK_SET_GAIN:
+            if (cmd->len < 3 || (cmd->arg[0] != LINK_ALL && cmd->arg[0] >= kMAX_MIX)) {
+                status = LINK_ERR_ARG;
+            } else {
+                float gain = (cmd->arg[1] | (cmd->arg[2] << 8)) / 256.0f;
+
+                if (cmd->arg[0] == LINK_ALL) {
+                    set_gain(gain);
+                } else if (_gen[cmd->arg[0]]->isRunning()) {
+                    _stub[cmd->arg[0]]->SetGain(gain / kMIX_HEADROOM);
+                } else {
+                    status = LINK_ERR_STATE;
+                }
+            }
+            break;
+
+        case LINK_UPLOAD_END:
+            // received and verified, swapped in while nothing has the clip open
+            if (_status != ST_IDLE) {
+                status = LINK_ERR_STATE;
+                break;
+            }
+            stop_music();
+            _cache.suspend();
+            if (!_link.get_upload_name() || !_library.install(_link.get_upload_path(), _link.get_upload_name()))
+                status = LINK_ERR_IO;
+            _link.end_upload();
+            _cache.resume();
+            break;
+
+        case LINK_REC_START:
+            if (_status == ST_RECORDING)
+                status = LINK_ERR_STATE;
+            else
+                start_rec();
+            break;
+
+        case LINK_REC_STOP:
+            if (_status != ST_RECORDING) {
+                status = LINK_ERR_STATE;
+            } else {
+                stop_rec();
+                _status = ST_IDLE;
+            }
+            break;
+
+        default:
+            status = LINK_ERR_CMD;
+            break;
+    }
+    _link.reply(cmd->cmd, cmd->seq, status);
+    return -1;
+}
+
 /*
 *****************************************************************************************
 *
@@ -195,9 +434,16 @@ void setup_rec(String fname) {
 void deep_sleep() {
     uint64_t mask;
 
+    stop_music();
+    _session.flush();
+    _cache.suspend();
     SD.end();
     digitalWrite(PIN_SD_PWR, LOW);
 
+    // every expander key can wake us, the expanders hold the request line low until we read it
+    if (_expander.is_present() && _expander.power_down())
+        esp_sleep_enable_ext0_wakeup((gpio_num_t)_expander.get_pin_int(), LOW);
+
     mask = 1LL << 36;
     esp_sleep_enable_ext1_wakeup(mask, ESP_EXT1_WAKEUP_ANY_HIGH);
     LOG("Going to sleep now !\n");
@@ -226,6 +472,112 @@ uint32_t check_wakeup_pin() {
     return key_mask;
 }
 
+// a key without a key-up to come plays its clip through instead of sustaining it
+void on_key_down(int key, bool sustain = true) {
+    // the recorder owns the card and the I2S pins until it stops
+    if (_status == ST_RECORDING)
+        return;
+
+    clip_info_t *clip = _library.find_by_number(key);
+
+    TRACE(TR_KEY, key, clip ? ClipLibrary::get_id(clip) : -1);
+    if (clip != NULL)
+        _session.add(_composing ? SESSION_PHRASE_ADD : SESSION_KEY, key, ClipLibrary::get_id(clip));
+
+    if (clip != NULL && _composing) {
+        String     path = _library.get_path(clip);
+        wav_info_t info;
+
+        // the next word of the sentence is prefetched while it is being composed
+        if (_phrase->Add(path.c_str(), clip->gain, ClipLibrary::get_wav_info(clip, &info) ? &info : NULL))
+            _cache.request(path.c_str());
+        else
+            LOG("phrase full\n");
+        return;
+    }
+    if (clip != NULL && setup_play(clip, sustain ? key : -1) >= 0)
+        _status = ST_PLAYING;
+}
+
+// ends the sustain loop of the voice the key started, its release tail plays out
+void on_key_up(int key) {
+    int slot = -1;
+
+    for (int i = 0; i < kMAX_MIX; i++) {
+        if (_voice_key[i] == key) {
+            _file_src[i]->Release();
+            _voice_key[i] = -1;
+            slot = i;
+        }
+    }
+    TRACE(TR_KEY_UP, key, slot);
+}
+
+// sustain loops held past kMAX_SUSTAIN_MS, or all of them once a key-up may have been lost
+static void release_sustained(bool all) {
+    for (int i = 0; i < kMAX_MIX; i++) {
+        if (_voice_key[i] >= 0 && (all || IS_ELAPSED(millis(), _voice_ts[i], (uint32_t)kMAX_SUSTAIN_MS))) {
+            TRACE(TR_KEY_UP, _voice_key[i], i);
+            _file_src[i]->Release();
+            _voice_key[i] = -1;
+        }
+    }
+}
+
+// the soak feeds presses straight in, everything else comes back as a console key
+int on_soak_event() {
+    int arg;
+    int evt = _soak.poll(&arg);
+
+    // a press is held until the next event
+    if (evt != SOAK_NONE && _soak_key >= 0) {
+        on_key_up(_soak_key);
+        _soak_key = -1;
+    }
+
+    switch (evt) {
+        case SOAK_KEY:
+            on_key_down(arg);
+            _soak_key = arg;
+            break;
+
+        case SOAK_PLAY:
+            return 'p';
+
+        case SOAK_COMPOSE:
+            return 'c';
+
+        case SOAK_GAIN:
+            return arg ? ']' : '[';
+
+        case SOAK_REC:
+            return 'r';
+    }
+    return -1;
+}
+
+// what the soak can not see for itself : voices running longer than any clip and files
+// left open by a stopped voice show up here first
+void sample_soak(uint32_t loop_us) {
+    soak_sample_t s;
+
+    s.loop_us      = loop_us;
+    s.open_files   = _cache.get_open_count() + _phrase->isOpen();
+    s.voices       = 0;
+    s.stuck_voices = 0;
+    for (int i = 0; i < kMAX_MIX; i++) {
+        if (_file_src[i]->isOpen())
+            s.open_files++;
+        if (_gen[i]->isRunning()) {
+            s.voices++;
+            if (IS_ELAPSED(millis(), _voice_ts[i], (uint32_t)kSOAK_STUCK_MS))
+                s.stuck_voices++;
+        }
+    }
+    s.idle = (_status == ST_IDLE);
+    _soak.sample(&s);
+}
+
 uint32_t check_pin() {
     uint32_t key_mask = 0;
 
@@ -237,11 +589,6 @@ uint32_t check_pin() {
 }
 
 void setup() {
-    for (int i = 0; i < kMAX_MIX; i++) {
-        _gen[i] = new AudioGeneratorWAV();
-        _file_src[i] = new AudioFileSourceSD();
-    }
-
     for (int i = 0; i < sizeof(_tbl_touch_pins); i++) {
         pinMode(_tbl_touch_pins[i], INPUT);
     }
@@ -253,8 +600,15 @@ void setup() {
 
     WiFi.mode(WIFI_OFF);
     setCpuFrequencyMhz(240);
+    Serial.setRxBufferSize(kSERIAL_RX_BUF);
     Serial.begin(115200);
+    _link.begin();
+    alloc_pools();
     // heap_caps_malloc_extmem_enable(512);
+    _session.begin();
+#if __TRACE__
+    trace_begin(&Serial, kTRACE_DRAIN_MS);
+#endif
 
     LOG("chip:%s, revision:%d, flash:%d, heap:%d, psram:%d\n", ESP.getChipModel(), ESP.getChipRevision(),
         ESP.getFlashChipSize(), ESP.getFreeHeap(), ESP.getPsramSize());
@@ -267,14 +621,18 @@ void setup() {
     // LOG("largest heap size : %d\n", heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
 
     _spi_sd.begin(PIN_SD_CLK, PIN_SD_MISO, PIN_SD_MOSI, -1);
-    if (SD.begin(PIN_SD_CS, _spi_sd)) {
+    if (SD.begin(PIN_SD_CS, _spi_sd, 4000000, "/sd", kSD_MAX_FILES)) {
         uint8_t cardType = SD.cardType();
 
         if (cardType != CARD_NONE) {
             uint64_t cardSize = SD.cardSize() / (1024 * 1024);
             LOG(", SD Card Size: %lluMB\n", cardSize);
-            listDir(SD, "/words", 0);
-            _dir = SD.open("/words");
+            _library.scan();
+
+            // until keys are pressed the first words of the library are the best guess
+            _cache.begin();
+            for (int i = 0; i < min(_library.get_count(), (int)ClipCache::kMAX_ENTRIES); i++)
+                _cache.request(_library.get_path(_library.get(i)).c_str());
         } else {
             LOG("No SD card attached\n");
         }
@@ -282,122 +640,276 @@ void setup() {
         LOG("Card Mount Failed\n");
     }
 
-    audioLogger = &Serial;
-    // deep_sleep(true);
-}
+    // keys come from the expander when it is fitted, the direct touch pins otherwise
+    Wire.begin(PIN_EXP_SDA, PIN_EXP_SCL, 400000);
+    _expander.begin(Wire, EXP_DEBOUNCE_MS);
 
-char *get_file_with_number(int number) {
-    char buf[5];
+    // play the word of the key that woke us, the expander latched it before we were up.
+    // The pin snapshot of begin() dropped the pending events, a short tap's key-up with
+    // them, so the word plays through once
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) {
+        key_event_t evt;
 
-    sprintf(buf, "%02d_", number);
-    for (int i = 0; i < 20; i++) {
-        if (_file_list[i] != NULL && String(_file_list[i]).startsWith(buf))
-            return _file_list[i];
+        if (_expander.get_wake_key(&evt)) {
+            LOG("wake up key:%d\n", evt.key);
+            if (evt.down)
+                on_key_down(evt.key, false);
+        }
     }
-    return NULL;
+
+    audioLogger = &Serial;
+    // deep_sleep(true);
 }
 
 void loop() {
     int key;
     int16_t bytes;
     bool ret;
+    uint32_t loop_ts = micros();
 
-    uint32_t btn = (_dw_wake_btn > 0) ? _dw_wake_btn : check_pin();
-    if (btn > 0) {
+    if (_expander.is_present() && _dw_wake_btn == 0) {
+        key_event_t evt;
+
+        _expander.service();
+        while (_expander.get_event(&evt)) {
+            if (evt.down)
+                on_key_down(evt.key);
+            else
+                on_key_up(evt.key);
+        }
+        if (_expander.take_lost())
+            release_sustained(true);
+    } else {
+        uint32_t btn = (_dw_wake_btn > 0) ? _dw_wake_btn : check_pin();
         uint32_t chg = btn ^ _dw_old_btn;
 
-        if (chg > 0) {
-            for (int i = 0; i < sizeof(_tbl_touch_pins); i++) {
-                if ((chg & BV(i)) && (btn & BV(i))) {
-                    char *fname = get_file_with_number(i);
-                    LOG("key touched : %2d %s\n", i, fname);
-                    if (fname != NULL && setup_play("/words/" + String(fname)))
-                        _status = ST_PLAYING;
-                }
-            }
+        for (int i = 0; i < sizeof(_tbl_touch_pins); i++) {
+            if (!(chg & BV(i)))
+                continue;
+            if (btn & BV(i))
+                on_key_down(i);
+            else
+                on_key_up(i);
         }
         if (_dw_wake_btn > 0)
             _dw_wake_btn = 0;
+        _dw_old_btn = btn;
     }
-    _dw_old_btn = btn;
 
-    key = Serial.available() ? Serial.read() : -1;
+    // the link task decodes the frames, only what touches the audio chain lands here
+    link_cmd_t cmd;
+    key = _link.get_cmd(&cmd) ? on_link_cmd(&cmd) : -1;
+    if (key < 0 && _soak.is_running())
+        key = on_soak_event();
 
     // global key
     switch (key) {
         case ']':
-            _gain = (_gain < 2.0) ? (_gain + 0.1) : _gain;
+            set_gain((_gain < 2.0) ? (_gain + 0.1) : _gain);
             LOG("Gain : %2.1f\n", _gain);
-            if (_i2s_out)
-                _i2s_out->SetGain(_gain);
             break;
 
         case '[':
-            _gain = (_gain > 0) ? (_gain - 0.1) : _gain;
+            set_gain((_gain > 0) ? (_gain - 0.1) : _gain);
             LOG("Gain : %2.1f\n", _gain);
-            if (_i2s_out)
-                _i2s_out->SetGain(_gain);
             break;
 
         case 'p':
-            if (_status != ST_RECORDING) {
-                while (true) {
-                    File file = _dir.openNextFile();
-                    if (file) {
-                        if (setup_play("/words/" + String(file.name()))) {
-                            _status = ST_PLAYING;
-                            break;
-                        }
-                    } else {
-                        _dir.rewindDirectory();
-                    }
-                }
+            if (_status != ST_RECORDING && _library.get_count() > 0) {
+                clip_info_t *clip = _library.get(_play_idx);
+
+                _session.add(SESSION_KEY, SESSION_KEY_NONE, ClipLibrary::get_id(clip));
+                if (setup_play(clip) >= 0)
+                    _status = ST_PLAYING;
+                _play_idx = (_play_idx + 1) % _library.get_count();
+            }
+            break;
+
+        case 'w':
+            // session review : every logged press mixed into one file on the card
+            if (_status == ST_IDLE) {
+                stop_music();
+                SessionRender render(_library, kMIX_HEADROOM, kRENDER_MAX_GAP_MS);
+                uint32_t      ts = millis();
+
+                _session.flush();
+                int cnt = render.render(SD, _session.get_path(), "/sd/session.wav");
+                LOG("session rendered : %d events, %lu ms\n", cnt, (unsigned long)(millis() - ts));
+            }
+            break;
+
+        case 'G':
+        case 'B':
+            // mixer regression : scripted renders against GoldenRef.h, 'B' prints a new table for it
+            if (_status == ST_IDLE) {
+                Golden golden(SD, _library, kMIX_HEADROOM, "/golden.log");
+
+                stop_music();
+                golden.run(Serial, key == 'B');
+            }
+            break;
+
+        case 'b':
+            // background music from the module in flash, it plays on under the words
+            if (_music->isRunning()) {
+                _music->stop();
+            } else if (_status != ST_RECORDING) {
+                _music_stub->SetGain(kMUSIC_GAIN / kMIX_HEADROOM);
+                start_output();
+                if (_music->begin(NULL, _ducker))
+                    LOG("music : %s\n", _music->GetTitle());
             }
             break;
 
+        case 'd':
+            _duck = !_duck;
+            _ducker->SetDuck(_duck ? kDUCK_DEPTH : 1.0f, kDUCK_ATTACK_MS, kDUCK_RELEASE_MS);
+            LOG("music ducking : %d\n", _duck);
+            break;
+
+        case 'u':
+            // CPU of the music engine in 1/10 % of a core : while it plays and flat out on a copy
+            LOG("music load : %u.%u%%\n", _music->GetLoad() / 10, _music->GetLoad() % 10);
+            if (_status == ST_IDLE) {
+                AudioGeneratorTracker bench(enigma_mod, sizeof(enigma_mod));
+                uint16_t load;
+
+                stop_music();
+                load = bench.Bench(kMUSIC_BENCH_MS);
+
+                LOG("music bench : %u.%u%% at 22050Hz, %d ms of song\n", load / 10, load % 10, kMUSIC_BENCH_MS);
+            }
+            break;
+
+        case 'l':
+            // limiter cost per frame below the threshold and limiting hard, in CPU cycles
+            if (_status == ST_IDLE) {
+                uint32_t quiet, loud;
+                uint32_t mhz = getCpuFrequencyMhz();
+
+                stop_music();
+                quiet = AudioOutputLimiter::Bench(1.0f, kLIMITER_BENCH_FRAMES);
+                loud  = AudioOutputLimiter::Bench(4.0f, kLIMITER_BENCH_FRAMES);
+
+                LOG("limiter bench : %u cycles/frame quiet, %u limiting, %u.%02u%% of a core at 22050Hz\n",
+                    (unsigned)quiet, (unsigned)loud, (unsigned)(loud * 22050 / (mhz * 10000)),
+                    (unsigned)(loud * 22050 / (mhz * 100) % 100));
+            }
+            break;
+
+        case 'h':
+            mem_report(Serial);
+            break;
+
+        case 'x':
+            LOG("session log cleared : %d\n", _session.clear());
+            break;
+
+        case 'S':
+            // the seed is in every report, kSOAK_SEED replays a run that found something.
+            // every press lands in the session log, 'x' clears it afterwards
+            if (_soak.is_running()) {
+                _soak.stop();
+                if (_soak_key >= 0)
+                    on_key_up(_soak_key);
+                _soak_key = -1;
+            } else {
+                uint32_t seed = kSOAK_SEED ? kSOAK_SEED : esp_random();
+
+                _soak.start(seed, kSOAK_MAX_KEY);
+                LOG("soak started, seed:%u\n", (unsigned)seed);
+            }
+            break;
+
+#if __METRICS__
+        case 'm':
+            metric_dump(Serial);
+            break;
+
+        case 'M':
+            metric_reset();
+            LOG("metrics reset\n");
+            break;
+#endif
+
+#if __TRACE__
+        case 't':
+            // whatever is left in the trace buffer, then how much of it was overwritten
+            while (trace_dump(Serial, 64) > 0)
+                ;
+            LOG("trace lost : %u\n", (unsigned)trace_get_lost());
+            break;
+
+        case 'T':
+            trace_set_drain(!trace_get_drain());
+            LOG("trace drain : %d\n", trace_get_drain());
+            break;
+#endif
+
+        case 'c':
+            // compose a sentence from the next keys, the second 'c' plays it
+            if (_status == ST_RECORDING)
+                break;
+            if (!_composing) {
+                _phrase->Clear();
+                _composing = true;
+                LOG("COMPOSE\n");
+            } else {
+                _composing = false;
+                if (setup_phrase())
+                    _status = ST_PLAYING;
+            }
+            break;
+
+        case 'g':
+            _phrase->SetGap(_phrase_gap ? 0 : kPHRASE_GAP_MS);
+            _phrase_gap = !_phrase_gap;
+            LOG("phrase gap : %d ms\n", _phrase_gap ? kPHRASE_GAP_MS : 0);
+            break;
+
         case 'r':
             if (_status == ST_RECORDING) {
-                _wav_writer->stop();
-                _i2s_in->stop();
-                LOG("STOP RECORDING!\n");
+                stop_rec();
                 _status = ST_IDLE;
             } else {
-                // stop playing
-                for (int i = 0; i < kMAX_MIX; i++) {
-                    if (_gen[i]->isRunning()) {
-                        _gen[i]->stop();
-                        _stub[i]->stop();
-                        delete _stub[i];
-                    }
-                }
-                _i2s_out->stop();
-
-                // start recording
-                setup_rec("/sd/words/rec.wav");
-                LOG("START RECORDING!\n");
-                _status = ST_RECORDING;                
-            } 
+                start_rec();
+            }
             break;
     }
 
     switch (_status) {
         case ST_PLAYING:
             if (true) {
-                bool idle = true;
+                bool     idle   = true;
+                int      voices = 0;
+                uint32_t ts;
+
+                // open the next word of a sentence while the current one plays
+                _phrase->Preload();
+                release_sustained(false);
+
+                ts = micros();
+                if (_play_ts && ts - _play_ts > kI2S_DMA_US)
+                    METRIC_INC(MC_UNDERRUN);
+                _play_ts = ts;
 
                 for (int i = 0; i < kMAX_MIX; i++) {
                     if (_gen[i]->isRunning()) {
                         idle = false;
+                        voices++;
                         if (!_gen[i]->loop()) {
                             _gen[i]->stop();
-                            _stub[i]->stop();
-                            LOG("STOP PLAYING slot:%d\n", i);
-                            delete _stub[i];
+                            TRACE(TR_PLAY_STOP, i, 0);
                         }
                     }
                 }
+                METRIC_ADD(MH_VOICES, voices);
+                if (!idle)
+                    METRIC_ADD(MH_RENDER_US, micros() - ts);
                 if (idle) {
-                    _status = ST_IDLE;
+                    // the gap to the next word is no underrun, the music may go on in it
+                    _play_ts = 0;
+                    _status  = ST_IDLE;
                     break;
                 }
             }
@@ -405,15 +917,45 @@ void loop() {
 
         case ST_RECORDING:
             bytes = _i2s_in->read(_rec_buf, _rec_buf_size);
-            _wav_writer->write(_rec_buf, bytes / sizeof(int16_t));
-            LOG(".");
+            switch (_vad->process(_rec_buf, bytes / sizeof(int16_t), _wav_writer)) {
+                case VoiceDetector::VAD_START:
+                    TRACE(TR_VAD_START, 0, 0);
+                    break;
+
+                case VoiceDetector::VAD_SPEECH:
+                    TRACE(TR_REC_BLOCK, bytes, 0);
+                    break;
+
+                case VoiceDetector::VAD_END:
+                    TRACE(TR_VAD_END, 0, 0);
+                    stop_rec();
+                    _status = ST_IDLE;
+                    break;
+            }
             break;
 
         case ST_IDLE:
+            // no card writes under the music, the RTC ring keeps the newest events until it stops
+            if (!_music->isRunning() &&
+                (_session.get_pending() >= kSESSION_FLUSH_BATCH ||
+                 (_session.get_pending() > 0 && IS_ELAPSED(millis(), _session.get_last_add(), kSESSION_FLUSH_IDLE_MS))))
+                _session.flush();
+
             if (digitalRead(PIN_SLEEP_TEST) == LOW) {
                 while (digitalRead(PIN_SLEEP_TEST) == LOW);
                 deep_sleep();
             }
             break;
     }
+
+    // the music plays on in any state but recording, it never keeps the loop from idle.
+    // words duck it, its own gain and the master gain stay where they are
+    if (_music->isRunning()) {
+        _ducker->SetSidechain(_status == ST_PLAYING);
+        _music->loop();
+    }
+
+    METRIC_ADD(MH_LOOP_US, micros() - loop_ts);
+    if (_soak.is_running())
+        sample_soak(micros() - loop_ts);
 }
@@ -0,0 +1,700 @@
+/*
+ This project is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ see <http://www.gnu.org/licenses/>
+*/
+
+// host side of src/SerialLink : one command per run over the board's serial port.
+//   c++ -O2 -o toto_link toto_link.cpp
+//   ./toto_link -p /dev/ttyUSB0 ping
+// anything the board logs between the frames goes to stderr with -v
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*
+*****************************************************************************************
+* CONSTANTS
+*****************************************************************************************
+*/
+// the same numbers as SerialLink.h, the firmware header needs Arduino.h
+enum : uint8_t {
+    LINK_PING = 0x01,
+    LINK_KEY,
+    LINK_SET_BAUD,
+
+    LINK_PLAY = 0x10,
+    LINK_STOP,
+    LINK_SET_GAIN,
+    LINK_REC_START,
+    LINK_REC_STOP,
+
+    LINK_METRICS = 0x20,
+
+    LINK_FILE_OPEN = 0x30,
+    LINK_FILE_WRITE,
+    LINK_FILE_READ,
+    LINK_FILE_CLOSE,
+
+    LINK_UPLOAD_BEGIN = 0x38,
+    LINK_UPLOAD_DATA,
+    LINK_UPLOAD_END,
+};
+
+enum : uint8_t {
+    LINK_OK = 0,
+    LINK_MORE,
+    LINK_ERR_CMD,
+    LINK_ERR_ARG,
+    LINK_ERR_STATE,
+    LINK_ERR_IO,
+};
+
+#define LINK_RSP                0x80
+#define LINK_ALL                0xFF
+
+static const int kMAX_PAYLOAD  = 240;
+static const int kMAX_FRAME    = kMAX_PAYLOAD + 8;
+static const int kMAX_COBS     = kMAX_FRAME + kMAX_FRAME / 254 + 2;
+static const int kFILE_CHUNK   = 232;       // data of one LINK_FILE_WRITE, request frames carry cmd and seq too
+static const int kUPLOAD_CHUNK = 228;       // behind the offset of LINK_UPLOAD_DATA
+static const int kTIMEOUT_MS   = 1000;
+static const int kRETRIES      = 3;
+static const int kBUSY_MS      = 200;       // END again while the board is playing
+static const int kBUSY_RETRIES = 50;
+
+/*
+*****************************************************************************************
+* MACROS & STRUCTURES
+*****************************************************************************************
+*/
+typedef struct _link_rsp {
+    uint8_t     cmd;
+    uint8_t     seq;
+    uint8_t     status;
+    int         len;
+    uint8_t     data[kMAX_PAYLOAD];
+} link_rsp_t;
+
+/*
+*****************************************************************************************
+* VARIABLES
+*****************************************************************************************
+*/
+static int      _fd = -1;
+static uint8_t  _seq;
+static bool     _verbose;
+static uint8_t  _rx[kMAX_COBS];
+static int      _rx_len;
+static uint8_t  _in[256];                   // read from the port, not looked at yet
+static int      _in_len;
+static int      _in_pos;
+
+/*
+*****************************************************************************************
+* frame coding, the same as the firmware
+*****************************************************************************************
+*/
+static uint16_t crc16(const uint8_t *buf, int len) {
+    uint16_t crc = 0xffff;
+
+    while (len--) {
+        crc ^= *buf++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, int len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static int cobs_encode(const uint8_t *src, int len, uint8_t *dst) {
+    int code_pos = 0;
+    int out      = 1;
+    uint8_t code = 1;
+
+    for (int i = 0; i < len; i++) {
+        if (src[i]) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (!src[i] || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code     = 1;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+static int cobs_decode(const uint8_t *src, int len, uint8_t *dst) {
+    int out = 0;
+
+    for (int i = 0; i < len;) {
+        uint8_t code = src[i++];
+
+        if (code == 0 || i + code - 1 > len)
+            return -1;
+        for (int j = 1; j < code; j++)
+            dst[out++] = src[i++];
+        if (code < 0xff && i < len)
+            dst[out++] = 0;
+    }
+    return out;
+}
+
+// the same fold of FNV-1a as ClipLibrary::get_id(), a clip can be played by its name
+static uint16_t clip_id(const char *name) {
+    uint32_t h = 2166136261UL;
+
+    for (const char *p = name; *p; p++)
+        h = (h ^ (uint8_t)*p) * 16777619UL;
+    return (h >> 16) ^ (h & 0xffff);
+}
+
+static uint32_t now_ms() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void die(const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+/*
+*****************************************************************************************
+* serial port
+*****************************************************************************************
+*/
+static speed_t to_speed(int baud) {
+    static const struct { int baud; speed_t speed; } tbl[] = {
+        { 9600, B9600 },     { 19200, B19200 },   { 38400, B38400 },   { 57600, B57600 },
+        { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+        { 460800, B460800 }, { 500000, B500000 }, { 921600, B921600 }, { 1000000, B1000000 },
+        { 2000000, B2000000 },
+#endif
+    };
+
+    for (unsigned i = 0; i < sizeof(tbl) / sizeof(tbl[0]); i++) {
+        if (tbl[i].baud == baud)
+            return tbl[i].speed;
+    }
+    die("baud %d is not supported\n", baud);
+    return B0;
+}
+
+static void set_baud(int baud) {
+    struct termios tio;
+
+    if (tcgetattr(_fd, &tio) < 0)
+        die("tcgetattr : %s\n", strerror(errno));
+    cfsetispeed(&tio, to_speed(baud));
+    cfsetospeed(&tio, to_speed(baud));
+    if (tcsetattr(_fd, TCSANOW, &tio) < 0)
+        die("tcsetattr : %s\n", strerror(errno));
+}
+
+static void port_open(const char *path, int baud) {
+    struct termios tio;
+    int            lines = TIOCM_DTR | TIOCM_RTS;
+
+    _fd = open(path, O_RDWR | O_NOCTTY);
+    if (_fd < 0)
+        die("%s : %s\n", path, strerror(errno));
+    if (tcgetattr(_fd, &tio) < 0)
+        die("tcgetattr : %s\n", strerror(errno));
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~HUPCL;
+    tio.c_cc[VMIN]  = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(_fd, TCSANOW, &tio) < 0)
+        die("tcsetattr : %s\n", strerror(errno));
+    set_baud(baud);
+
+    // DTR and RTS drive EN and IO0 on the dev boards, released they leave it running
+    ioctl(_fd, TIOCMBIC, &lines);
+    tcflush(_fd, TCIOFLUSH);
+}
+
+static void port_write(const uint8_t *buf, int len) {
+    while (len > 0) {
+        int n = write(_fd, buf, len);
+
+        if (n < 0 && errno != EINTR && errno != EAGAIN)
+            die("write : %s\n", strerror(errno));
+        if (n > 0) {
+            buf += n;
+            len -= n;
+        }
+    }
+}
+
+/*
+*****************************************************************************************
+* requests
+*****************************************************************************************
+*/
+// a leading delimiter ends whatever the board has taken for the start of a frame
+static uint8_t send_req(uint8_t cmd, const void *arg, int len) {
+    uint8_t raw[kMAX_FRAME];
+    uint8_t out[kMAX_COBS + 2];
+
+    if (len > kMAX_FRAME - 4)
+        die("request too long\n");
+    raw[0] = cmd;
+    raw[1] = ++_seq;
+    if (len > 0)
+        memcpy(&raw[2], arg, len);
+
+    uint16_t crc = crc16(raw, len + 2);
+    raw[len + 2] = crc & 0xff;
+    raw[len + 3] = crc >> 8;
+
+    int n = cobs_encode(raw, len + 4, &out[1]);
+    out[0]     = 0;
+    out[n + 1] = 0;
+    port_write(out, n + 2);
+    return _seq;
+}
+
+// the next byte from the port, -1 after ms
+static int read_byte(uint32_t end) {
+    while (_in_pos == _in_len) {
+        int            left = (int)(end - now_ms());
+        struct timeval tv;
+        fd_set         set;
+
+        if (left <= 0)
+            return -1;
+        tv.tv_sec  = left / 1000;
+        tv.tv_usec = (left % 1000) * 1000;
+        FD_ZERO(&set);
+        FD_SET(_fd, &set);
+        if (select(_fd + 1, &set, NULL, NULL, &tv) <= 0)
+            continue;
+        _in_len = read(_fd, _in, sizeof(_in));
+        _in_pos = 0;
+        if (_in_len < 0)
+            _in_len = 0;
+    }
+    return _in[_in_pos++];
+}
+
+// the next good response frame within ms, text and broken frames are skipped
+static bool read_rsp(link_rsp_t *rsp, int ms) {
+    uint32_t end = now_ms() + ms;
+    uint8_t  frame[kMAX_COBS];
+    int      c;
+
+    while ((c = read_byte(end)) >= 0) {
+        if (c != 0) {
+            if (_rx_len < (int)sizeof(_rx))
+                _rx[_rx_len++] = c;
+            continue;
+        }
+
+        int len = (_rx_len > 0) ? cobs_decode(_rx, _rx_len, frame) : -1;
+        if (len >= 5 && (frame[0] & LINK_RSP) && crc16(frame, len - 2) == (frame[len - 2] | (frame[len - 1] << 8))) {
+            rsp->cmd    = frame[0] & ~LINK_RSP;
+            rsp->seq    = frame[1];
+            rsp->status = frame[2];
+            rsp->len    = len - 5;
+            memcpy(rsp->data, &frame[3], rsp->len);
+            _rx_len = 0;
+            return true;
+        }
+        if (_verbose && _rx_len > 0)
+            fwrite(_rx, 1, _rx_len, stderr);
+        _rx_len = 0;
+    }
+    return false;
+}
+
+// one request answered by one response, sent again while nothing comes back
+static uint8_t request(uint8_t cmd, const void *arg, int len, link_rsp_t *rsp) {
+    for (int retry = 0; retry < kRETRIES; retry++) {
+        uint8_t  seq = send_req(cmd, arg, len);
+        uint32_t end = now_ms() + kTIMEOUT_MS;
+
+        while (read_rsp(rsp, (int)(end - now_ms()))) {
+            if (rsp->cmd == cmd && rsp->seq == seq && rsp->status != LINK_MORE)
+                return rsp->status;
+        }
+    }
+    die("no answer to command 0x%02x\n", cmd);
+    return LINK_ERR_IO;
+}
+
+static const char *status_name(uint8_t status) {
+    static const char *names[] = { "ok", "more", "unknown command", "bad argument", "busy", "io error" };
+
+    return (status < sizeof(names) / sizeof(names[0])) ? names[status] : "?";
+}
+
+static int check(uint8_t status, const char *what) {
+    if (status == LINK_OK)
+        return 0;
+    fprintf(stderr, "%s : %s\n", what, status_name(status));
+    return 1;
+}
+
+// slot number or "all"
+static uint8_t parse_slot(const char *s) {
+    return !strcmp(s, "all") ? LINK_ALL : (uint8_t)atoi(s);
+}
+
+/*
+*****************************************************************************************
+* commands
+*****************************************************************************************
+*/
+static int cmd_ping() {
+    link_rsp_t rsp;
+
+    if (check(request(LINK_PING, NULL, 0, &rsp), "ping"))
+        return 1;
+    printf("link version %d\n", rsp.len > 0 ? rsp.data[0] : 0);
+    return 0;
+}
+
+static int cmd_key(const char *key) {
+    link_rsp_t rsp;
+
+    return check(request(LINK_KEY, key, 1, &rsp), "key");
+}
+
+// answered at the old rate, the port follows the board after it
+static int cmd_baud(int baud) {
+    link_rsp_t rsp;
+    uint8_t    arg[4];
+
+    to_speed(baud);
+    put_u32(arg, baud);
+    if (check(request(LINK_SET_BAUD, arg, 4, &rsp), "baud"))
+        return 1;
+    tcdrain(_fd);
+    set_baud(baud);
+    printf("board at %d baud, use -b %d from now on\n", baud, baud);
+    return 0;
+}
+
+// a clip by its file name in /words, or by its id as 0x1234
+static int cmd_play(const char *clip) {
+    link_rsp_t rsp;
+    uint16_t   id = !strncmp(clip, "0x", 2) ? (uint16_t)strtoul(clip, NULL, 16) : clip_id(clip);
+    uint8_t    arg[2] = { (uint8_t)id, (uint8_t)(id >> 8) };
+
+    if (check(request(LINK_PLAY, arg, 2, &rsp), "play"))
+        return 1;
+    printf("clip %04x on voice %d\n", id, rsp.len > 0 ? rsp.data[0] : -1);
+    return 0;
+}
+
+static int cmd_stop(const char *slot) {
+    link_rsp_t rsp;
+    uint8_t    arg = parse_slot(slot);
+
+    return check(request(LINK_STOP, &arg, 1, &rsp), "stop");
+}
+
+// master gain with "all", a voice gain otherwise
+static int cmd_gain(const char *slot, const char *gain) {
+    link_rsp_t rsp;
+    uint16_t   val = (uint16_t)(atof(gain) * 256 + 0.5);
+    uint8_t    arg[3] = { parse_slot(slot), (uint8_t)val, (uint8_t)(val >> 8) };
+
+    return check(request(LINK_SET_GAIN, arg, 3, &rsp), "gain");
+}
+
+static int cmd_rec(const char *what) {
+    link_rsp_t rsp;
+
+    if (!strcmp(what, "start"))
+        return check(request(LINK_REC_START, NULL, 0, &rsp), "rec start");
+    if (!strcmp(what, "stop"))
+        return check(request(LINK_REC_STOP, NULL, 0, &rsp), "rec stop");
+    die("rec start | stop\n");
+    return 1;
+}
+
+// LINK_MORE frames of JSON up to the closing LINK_OK, asked for only once
+static int cmd_metrics() {
+    link_rsp_t rsp;
+    uint8_t    seq = send_req(LINK_METRICS, NULL, 0);
+
+    while (read_rsp(&rsp, kTIMEOUT_MS * 2)) {
+        if (rsp.cmd != LINK_METRICS || rsp.seq != seq)
+            continue;
+        if (rsp.status != LINK_MORE) {
+            printf("\n");
+            return check(rsp.status, "metrics");
+        }
+        fwrite(rsp.data, 1, rsp.len, stdout);
+    }
+    die("metrics : no answer\n");
+    return 1;
+}
+
+static bool file_open(char mode, const char *path, uint32_t *size) {
+    link_rsp_t rsp;
+    uint8_t    arg[64];
+    int        len = strlen(path);
+
+    if (len + 1 >= (int)sizeof(arg))
+        die("path too long\n");
+    arg[0] = mode;
+    memcpy(&arg[1], path, len);
+    if (check(request(LINK_FILE_OPEN, arg, len + 1, &rsp), path))
+        return false;
+    if (size && rsp.len >= 4)
+        *size = get_u32(rsp.data);
+    return true;
+}
+
+// a card file to the host, read until the empty answer
+static int cmd_get(const char *remote, const char *local) {
+    link_rsp_t rsp;
+    uint32_t   size = 0;
+    uint32_t   done = 0;
+    uint8_t    max  = kMAX_PAYLOAD;
+    FILE      *fp;
+
+    if (!file_open('r', remote, &size))
+        return 1;
+    fp = fopen(local, "wb");
+    if (!fp)
+        die("%s : %s\n", local, strerror(errno));
+    for (;;) {
+        if (check(request(LINK_FILE_READ, &max, 1, &rsp), "read"))
+            break;
+        if (rsp.len == 0)
+            break;
+        fwrite(rsp.data, 1, rsp.len, fp);
+        done += rsp.len;
+    }
+    fclose(fp);
+    request(LINK_FILE_CLOSE, NULL, 0, &rsp);
+    printf("%s : %u of %u bytes\n", remote, done, size);
+    return done == size ? 0 : 1;
+}
+
+// a host file onto the card, every block is answered
+static int cmd_put(const char *local, const char *remote) {
+    link_rsp_t rsp;
+    uint8_t    buf[kFILE_CHUNK];
+    uint32_t   done = 0;
+    int        ret  = 0;
+    int        n;
+    FILE      *fp   = fopen(local, "rb");
+
+    if (!fp)
+        die("%s : %s\n", local, strerror(errno));
+    if (!file_open('w', remote, NULL)) {
+        fclose(fp);
+        return 1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if ((ret = check(request(LINK_FILE_WRITE, buf, n, &rsp), "write")) != 0)
+            break;
+        done += n;
+    }
+    fclose(fp);
+    request(LINK_FILE_CLOSE, NULL, 0, &rsp);
+    printf("%s : %u bytes\n", remote, done);
+    return ret;
+}
+
+// DATA from pos to the end without waiting, a gap answer moves pos back to where the
+// board wants to go on from
+static void upload_stream(const uint8_t *data, uint32_t size, uint32_t *pos) {
+    link_rsp_t rsp;
+    uint8_t    arg[4 + kUPLOAD_CHUNK];
+
+    while (*pos < size) {
+        int n = (size - *pos < (uint32_t)kUPLOAD_CHUNK) ? size - *pos : kUPLOAD_CHUNK;
+
+        put_u32(arg, *pos);
+        memcpy(&arg[4], data + *pos, n);
+        send_req(LINK_UPLOAD_DATA, arg, n + 4);
+        *pos += n;
+
+        while (read_rsp(&rsp, 0)) {
+            if (rsp.cmd != LINK_UPLOAD_DATA)
+                continue;
+            if (rsp.status == LINK_ERR_ARG && rsp.len >= 4) {
+                *pos = get_u32(rsp.data);
+                fprintf(stderr, "gap, again from %u\n", *pos);
+            } else {
+                die("upload : %s\n", status_name(rsp.status));
+            }
+        }
+    }
+}
+
+// a clip into /words, swapped in by the board once it is idle
+static int cmd_upload(const char *local, const char *name) {
+    link_rsp_t rsp;
+    uint8_t    arg[64];
+    uint32_t   size;
+    uint32_t   pos = 0;
+    uint8_t    status;
+    FILE      *fp  = fopen(local, "rb");
+
+    if (!name) {
+        name = strrchr(local, '/');
+        name = name ? name + 1 : local;
+    }
+    if (strlen(name) + 4 >= sizeof(arg))
+        die("name too long\n");
+    if (!fp)
+        die("%s : %s\n", local, strerror(errno));
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *data = (uint8_t *)malloc(size ? size : 1);
+    if (!data || fread(data, 1, size, fp) != size)
+        die("%s : read failed\n", local);
+    fclose(fp);
+
+    put_u32(arg, size);
+    memcpy(&arg[4], name, strlen(name));
+    if (check(request(LINK_UPLOAD_BEGIN, arg, strlen(name) + 4, &rsp), "upload begin"))
+        return 1;
+
+    put_u32(arg, crc32_update(0, data, size));
+    for (int tries = 0; tries < kBUSY_RETRIES; tries++) {
+        upload_stream(data, size, &pos);
+        status = request(LINK_UPLOAD_END, arg, 4, &rsp);
+        if (status == LINK_ERR_ARG && rsp.len >= 4) {
+            // the board is short of the end, the tail was lost
+            pos = get_u32(rsp.data);
+            fprintf(stderr, "short, again from %u\n", pos);
+            continue;
+        }
+        if (status != LINK_ERR_STATE)
+            break;
+        usleep(kBUSY_MS * 1000);
+    }
+    free(data);
+    if (check(status, "upload"))
+        return 1;
+    printf("%s : %u bytes as %s\n", local, size, name);
+    return 0;
+}
+
+/*
+*****************************************************************************************
+*
+*****************************************************************************************
+*/
+static void usage() {
+    fprintf(stderr,
+            "usage : toto_link [-p port] [-b baud] [-v] command\n"
+            "  ping                      link version\n"
+            "  key <c>                   one of the console keys\n"
+            "  baud <rate>               switch the board, then pass -b rate\n"
+            "  play <name | 0xid>        clip of /words, prints the voice\n"
+            "  stop <voice | all>\n"
+            "  gain <voice | all> <x>    all : the master gain\n"
+            "  rec <start | stop>\n"
+            "  metrics                   JSON of the counters and histograms\n"
+            "  get <card path> <file>\n"
+            "  put <file> <card path>\n"
+            "  upload <file.wav> [name]  clip into /words, the name of the file by default\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *port = "/dev/ttyUSB0";
+    int         baud = 115200;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "p:b:v")) != -1) {
+        switch (opt) {
+            case 'p': port = optarg; break;
+            case 'b': baud = atoi(optarg); break;
+            case 'v': _verbose = true; break;
+            default: usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 1)
+        usage();
+
+    port_open(port, baud);
+    _seq = (uint8_t)now_ms();
+
+    const char *cmd = argv[0];
+    if (!strcmp(cmd, "ping"))
+        return cmd_ping();
+    if (!strcmp(cmd, "key") && argc == 2 && strlen(argv[1]) == 1)
+        return cmd_key(argv[1]);
+    if (!strcmp(cmd, "baud") && argc == 2)
+        return cmd_baud(atoi(argv[1]));
+    if (!strcmp(cmd, "play") && argc == 2)
+        return cmd_play(argv[1]);
+    if (!strcmp(cmd, "stop") && argc == 2)
+        return cmd_stop(argv[1]);
+    if (!strcmp(cmd, "gain") && argc == 3)
+        return cmd_gain(argv[1], argv[2]);
+    if (!strcmp(cmd, "rec") && argc == 2)
+        return cmd_rec(argv[1]);
+    if (!strcmp(cmd, "metrics"))
+        return cmd_metrics();
+    if (!strcmp(cmd, "get") && argc == 3)
+        return cmd_get(argv[1], argv[2]);
+    if (!strcmp(cmd, "put") && argc == 3)
+        return cmd_put(argv[1], argv[2]);
+    if (!strcmp(cmd, "upload") && (argc == 2 || argc == 3))
+        return cmd_upload(argv[1], (argc == 3) ? argv[2] : NULL);
+    usage();
+    return 2;
+}